@@ -12,9 +12,12 @@
 #include "command_storage.h"
 #include "file.h"
 #include "file_storage.h"
+#include "jobserver.h"
 #include "jumppad.h"
 #include "os.h"
+#include "output_cache.h"
 #include "program.h"
+#include "remote_execution.h"
 #include "sw_context.h"
 
 #include <sw/support/filesystem.h>
@@ -30,6 +33,7 @@
 #include <primitives/sw/cl.h>
 #include <primitives/sw/settings_program_name.h>
 
+#include <fstream>
 #include <regex>
 
 #include <primitives/log.h>
@@ -40,14 +44,15 @@ static cl::opt<bool> save_all_commands("save-all-commands");
 static cl::opt<bool> save_executed_commands("save-executed-commands");
 static cl::opt<bool> explain_outdated("explain-outdated", cl::desc("Explain outdated commands"));
 static cl::opt<bool> explain_outdated_full("explain-outdated-full", cl::desc("Explain outdated commands with more info"));
+static cl::opt<bool> use_content_hash("content-hash", cl::desc("Do not rebuild commands when contents of their newer inputs is not changed"));
 static cl::opt<String> save_command_format("save-command-format", cl::desc("Explicitly set saved command format (bat or sh)"));
 
 namespace sw
 {
 
-static ConcurrentCommandStorage &getCommandStorage(const SwBuilderContext &swctx, bool local)
+static detail::Storage &getCommandStorage(const SwBuilderContext &swctx, bool local)
 {
-    return swctx.getCommandStorage().getStorage(local);
+    return swctx.getCommandStorage().getInternalStorage(local);
 }
 
 CommandNode::CommandNode()
@@ -87,7 +92,7 @@ static bool isExplainNeeded()
 
 static String getCommandId(const Command &c)
 {
-    String s = c.getName() + ", " + std::to_string(c.getHash()) + ", # of arguments " + std::to_string(c.arguments.size());
+    String s = c.getName() + ", " + c.getHash().toString() + ", # of arguments " + std::to_string(c.arguments.size());
     if (explain_outdated_full)
     {
         s += "\n";
@@ -141,10 +146,97 @@ bool Command::isOutdated() const
         auto &cs = getContext().getCommandStorage();
         ((Command*)(this))->mtime = r.first->mtime;
         ((Command*)(this))->implicit_inputs = r.first->getImplicitInputs(cs.getInternalStorage(command_storage == CS_LOCAL));
-        return isTimeChanged();
+        if (!isTimeChanged())
+            return false;
+        if (!use_content_hash || !r.first->content_hash)
+            return true;
+        return isContentChanged(*r.first);
     }
 }
 
+bool Command::isContentChanged(CommandRecord &r) const
+{
+    // outputs still must be in place and older than command
+    for (auto &o : outputs)
+    {
+        if (File(o, getContext().getFileStorage()).isChanged(mtime, false))
+            return true;
+    }
+
+    auto h = getContentHash();
+    if (h != r.content_hash)
+    {
+        if (isExplainNeeded())
+            EXPLAIN_OUTDATED("command", true, "contents of inputs changed", getCommandId(*this));
+        return true;
+    }
+
+    // same contents, move command time forward, so next time we won't rehash
+    auto t = mtime;
+    auto update_time = [this, &t](const auto &files)
+    {
+        for (auto i : files.getIds())
+            t = std::max(t, File(i, getContext().getFileStorage()).getFileData().last_write_time);
+    };
+    update_time(inputs);
+    update_time(implicit_inputs);
+    ((Command*)(this))->mtime = t;
+    r.mtime = t;
+    getContext().getCommandStorage().async_command_log(r, command_storage == CS_LOCAL);
+    return false;
+}
+
+uint64_t Command::getContentHash() const
+{
+    auto &pi = getPathInterner();
+
+    // sorted, because sets are unordered
+    std::vector<PathId> files(inputs.getIds().begin(), inputs.getIds().end());
+    files.insert(files.end(), implicit_inputs.getIds().begin(), implicit_inputs.getIds().end());
+    std::sort(files.begin(), files.end(), [&pi](auto f1, auto f2) { return pi.getString(f1) < pi.getString(f2); });
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+
+    // stored in db, so must be stable
+    Hasher128 h;
+    for (auto f : files)
+    {
+        h.update(pi.getString(f));
+        h.update(getFileContentHash(f));
+    }
+    auto r = h.digest().lo;
+    return r ? r : 1;
+}
+
+uint64_t Command::getFileContentHash(PathId f) const
+{
+    File file(f, getContext().getFileStorage());
+    auto &fd = file.getFileData();
+    if (auto h = fd.content_hash.load())
+        return h;
+    if (command_storage != CS_LOCAL && command_storage != CS_GLOBAL)
+        return file.getContentHash();
+
+    // files are hashed once, later processes take hashes from db while (mtime, size) is the same
+    auto &cs = getContext().getCommandStorage();
+    auto local = command_storage == CS_LOCAL;
+    FileHashRecord r;
+    r.file = getPathInterner().getHash(f);
+    if (cs.getInternalStorage(local).findFileHash(r.file, r) &&
+        r.mtime == (int64_t)fd.last_write_time.time_since_epoch().count() && r.size == fd.size && r.hash)
+    {
+        fd.content_hash = r.hash;
+        return r.hash;
+    }
+
+    r.hash = file.getContentHash();
+    if (!r.hash)
+        return 0; // missing
+    r.mtime = (int64_t)fd.last_write_time.time_since_epoch().count();
+    r.size = fd.size;
+    cs.async_file_hash_log(r, local);
+    return r.hash;
+}
+
 bool Command::isTimeChanged() const
 {
     try
@@ -167,54 +259,49 @@ bool Command::isTimeChanged() const
     }
 }
 
-size_t Command::getHash() const
+Hash128 Command::getHash() const
 {
-    if (hash != 0)
+    if (hash)
         return hash;
     return getHash1();
 }
 
-size_t Command::getHash1() const
+Hash128 Command::getArgumentsHash() const
 {
-    size_t h = 0;
-    hash_combine(h, std::hash<path>()(getProgram()));
-
-    // must sort arguments first
-    // because some command may generate args in unspecified order
-    std::set<String> args_sorted;
-
-    Strings sa;
+    // sum of digests, because some command may generate args in unspecified order
+    Hash128 h;
     for (auto &a : arguments)
-        args_sorted.insert(a->toString());
+        h += Hasher128().update(a->toString()).digest();
+    return h;
+}
 
-    for (auto &a : args_sorted)
-        hash_combine(h, std::hash<String>()(a));
+Hash128 Command::getHash1() const
+{
+    Hasher128 h;
+    h.update(getProgram());
+    h.update(getArgumentsHash());
 
     // redirections are also considered as arguments
-    if (!in.file.empty())
-        hash_combine(h, std::hash<path>()(in.file));
-    if (!out.file.empty())
-        hash_combine(h, std::hash<path>()(out.file));
-    if (!err.file.empty())
-        hash_combine(h, std::hash<path>()(err.file));
+    h.update(in.file.u8string());
+    h.update(out.file.u8string());
+    h.update(err.file.u8string());
 
-    hash_combine(h, std::hash<path>()(working_directory));
+    h.update(working_directory.u8string());
 
     // read other env vars? some of them may have influence
+    Hash128 env;
     for (auto &[k, v] : environment)
-    {
-        hash_combine(h, std::hash<String>()(k));
-        hash_combine(h, std::hash<String>()(v));
-    }
+        env += Hasher128().update(k).update(v).digest();
+    h.update(env);
 
     // command may depend on files not listed on the command line (dlls)?
     //for (auto &i : inputs)
         //hash_combine(h, std::hash<path>()(i));
 
-    return h;
+    return h.digest();
 }
 
-size_t Command::getHashAndSave() const
+Hash128 Command::getHashAndSave() const
 {
     return hash = getHash();
 }
@@ -365,7 +452,13 @@ void Command::execute()
 {
     if (!beforeCommand())
         return;
-    execute1(); // main thing
+    if (!restoreOutputs() && !executeRemotely())
+    {
+        // do not hold job token while waiting for memory
+        auto mem = acquireMemory();
+        auto lk = acquireJobToken();
+        execute1(); // main thing
+    }
     afterCommand();
 }
 
@@ -373,7 +466,13 @@ void Command::execute(std::error_code &ec)
 {
     if (!beforeCommand())
         return;
-    execute1(&ec); // main thing
+    if (!restoreOutputs() && !executeRemotely())
+    {
+        // do not hold job token while waiting for memory
+        auto mem = acquireMemory();
+        auto lk = acquireJobToken();
+        execute1(&ec); // main thing
+    }
     if (ec)
         return;
     afterCommand();
@@ -412,6 +511,148 @@ bool Command::beforeCommand()
     return true;
 }
 
+#ifdef __linux__
+// libuv reaps children itself, so we cannot get their rusage from wait4().
+// Instead we sample memory of process trees of running commands.
+// Compiler drivers (gcc, clang) do the real work in children (cc1plus, lto1, ld),
+// so the whole tree is accounted: sum of current rss of all processes,
+// but not less than peak rss (VmHWM) of any single process.
+// Commands shorter than sampling interval are not measured and keep their previous record.
+struct PeakMemoryMonitor
+{
+    std::mutex m;
+    std::unordered_set<Command *> cmds;
+
+    PeakMemoryMonitor()
+    {
+        std::thread([this]
+        {
+            while (1)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                std::unique_lock lk(m);
+                for (auto c : cmds)
+                    sample(*c);
+            }
+        }).detach();
+    }
+
+    void add(Command &c)
+    {
+        std::unique_lock lk(m);
+        cmds.insert(&c);
+    }
+
+    void remove(Command &c)
+    {
+        std::unique_lock lk(m);
+        cmds.erase(&c);
+    }
+
+    static void sample(Command &c)
+    {
+        // pid is set by the executing thread when process is started
+        auto pid = __atomic_load_n(&c.pid, __ATOMIC_ACQUIRE);
+        if (pid <= 0)
+            return;
+        uint64_t rss = 0, hwm = 0;
+        sampleTree(pid, rss, hwm);
+        // under monitor lock, command reads it only after remove()
+        c.peak_memory = std::max({ c.peak_memory, rss, hwm });
+    }
+
+    static void sampleTree(int pid, uint64_t &rss, uint64_t &hwm, int depth = 0)
+    {
+        // no real toolchain goes deeper
+        if (depth > 8)
+            return;
+
+        std::ifstream ifs("/proc/" + std::to_string(pid) + "/status");
+        String s;
+        while (std::getline(ifs, s))
+        {
+            if (s.compare(0, 6, "VmHWM:") == 0)
+                hwm = std::max<uint64_t>(hwm, std::stoull(s.substr(6)) * 1024);
+            else if (s.compare(0, 6, "VmRSS:") == 0)
+                rss += std::stoull(s.substr(6)) * 1024;
+        }
+
+        error_code ec;
+        for (auto &t : fs::directory_iterator("/proc/" + std::to_string(pid) + "/task", ec))
+        {
+            std::ifstream ifs(t.path() / "children");
+            int child;
+            while (ifs >> child)
+                sampleTree(child, rss, hwm, depth + 1);
+        }
+    }
+};
+
+static PeakMemoryMonitor &getPeakMemoryMonitor()
+{
+    static PeakMemoryMonitor *m = new PeakMemoryMonitor; // thread is detached, never destroy
+    return *m;
+}
+#endif
+
+void MemoryPool::acquire(uint64_t sz)
+{
+    if (!limit)
+        return;
+    std::unique_lock lk(m);
+    // too big commands run alone
+    cv.wait(lk, [this, sz] { return running == 0 || used + sz <= limit; });
+    used += sz;
+    running++;
+}
+
+void MemoryPool::release(uint64_t sz)
+{
+    if (!limit)
+        return;
+    std::unique_lock lk(m);
+    used -= sz;
+    running--;
+    lk.unlock();
+    cv.notify_all();
+}
+
+std::unique_lock<ResourcePool> Command::acquireJobToken()
+{
+    if (!jobserver)
+        return {};
+    // let child makes, ninjas etc. share our tokens
+    auto mf = jobserver->getMakeflags();
+    if (!mf.empty())
+        environment["MAKEFLAGS"] = mf;
+    return std::unique_lock<ResourcePool>(*jobserver);
+}
+
+std::shared_ptr<void> Command::acquireMemory()
+{
+    peak_memory = 0;
+    auto expected = getExpectedPeakMemory();
+    // sampling reads /proc every 10 ms, so measure only when the result is used
+    // or when there is nothing recorded yet
+    bool monitor = memory_pool || !expected;
+#ifdef __linux__
+    if (monitor)
+        getPeakMemoryMonitor().add(*this);
+#endif
+    auto sz = memory_pool ? expected : 0;
+    if (memory_pool)
+        memory_pool->acquire(sz);
+    return std::shared_ptr<void>(nullptr, [this, sz, monitor](void *)
+    {
+#ifdef __linux__
+        if (monitor)
+            getPeakMemoryMonitor().remove(*this);
+#endif
+        if (memory_pool)
+            memory_pool->release(sz);
+    });
+}
+
 void Command::afterCommand()
 {
     //if (always)
@@ -456,12 +697,95 @@ void Command::afterCommand()
 
     auto k = getHash();
     auto &cs = getContext().getCommandStorage();
-    auto &s = cs.getStorage(command_storage == CS_LOCAL);
+    auto &s = cs.getInternalStorage(command_storage == CS_LOCAL);
     auto &r = *s.insert(k).first;
     r.hash = k;
     r.mtime = mtime;
+    if (t_begin.time_since_epoch().count() != 0)
+        r.duration = std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_begin);
+    if (peak_memory)
+        r.peak_memory = peak_memory;
+    // stale hash of older run must not be compared later
+    r.content_hash = use_content_hash ? getContentHash() : 0;
     r.setImplicitInputs(implicit_inputs, cs.getInternalStorage(command_storage == CS_LOCAL));
     cs.async_command_log(r, command_storage == CS_LOCAL);
+
+    if (!restored_from_cache)
+        storeOutputs();
+}
+
+bool Command::isCacheable() const
+{
+    return getContext().getOutputCache() && !always && !outputs.empty() &&
+        (command_storage == CS_LOCAL || command_storage == CS_GLOBAL);
+}
+
+bool Command::restoreOutputs()
+{
+    if (!isCacheable())
+        return false;
+
+    // key is built from implicit inputs of the last cached run,
+    // if they are different now, content hash of the inputs is different too
+    auto &oc = *getContext().getOutputCache();
+    auto ii = oc.getImplicitInputs(getHash());
+    if (!ii)
+    {
+        oc.misses++;
+        return false;
+    }
+    auto recorded_implicit_inputs = std::move(implicit_inputs);
+    implicit_inputs = *ii;
+
+    auto r = oc.restore(getHash(), getContentHash(), FilesSorted(outputs.begin(), outputs.end()));
+    if (!r)
+    {
+        implicit_inputs = std::move(recorded_implicit_inputs);
+        return false;
+    }
+
+    LOG_TRACE(logger, "restored from output cache: " + getName());
+    restored_from_cache = true;
+    out.text = r->out;
+    err.text = r->err;
+    printOutputs();
+    return true;
+}
+
+bool Command::executeRemotely()
+{
+    auto re = getContext().getRemoteExecutor();
+    if (!re || remote_prefix_map_option.empty() || outputs.empty())
+        return false;
+    // implicit inputs are known only after the first local run
+    if (implicit_inputs.empty())
+        return false;
+    if (!in.file.empty() || !out.file.empty() || !err.file.empty())
+        return false;
+
+    for (auto &d : getGeneratedDirs())
+        fs::create_directories(d);
+
+    t_begin = Clock::now();
+    if (!re->execute(*this))
+        return false;
+    t_end = Clock::now();
+
+    LOG_TRACE(logger, "executed remotely: " + getName());
+    postProcess(); // process deps
+    printOutputs();
+    return true;
+}
+
+void Command::storeOutputs()
+{
+    if (!isCacheable())
+        return;
+    OutputCache::Result r;
+    r.out = out.text;
+    r.err = err.text;
+    getContext().getOutputCache()->store(getHash(), getContentHash(),
+        FilesSorted(outputs.begin(), outputs.end()), implicit_inputs, r);
 }
 
 path Command::getResponseFilename() const
@@ -600,7 +924,7 @@ void Command::printOutputs()
     s = log_string + "\n" + s;
     boost::trim(s);
     if (write_output_to_file)
-        write_file(fs::current_path() / SW_BINARY_DIR / "rsp" / std::to_string(getHash()) += ".txt", s);
+        write_file(fs::current_path() / SW_BINARY_DIR / "rsp" / getHash().toString() += ".txt", s);
     else
         LOG_INFO(logger, s);
 }
@@ -649,7 +973,7 @@ String Command::saveCommand() const
         return String{};
 
     // use "fancy" rsp name = command hash
-    auto p = fs::current_path() / SW_BINARY_DIR / "rsp" / (std::to_string(getHash()));
+    auto p = fs::current_path() / SW_BINARY_DIR / "rsp" / getHash().toString();
     p = writeCommand(p);
 
     String s;
@@ -1035,11 +1359,9 @@ void Command::addPathDirectory(const path &p)
 
 bool Command::lessDuringExecution(const CommandNode &in) const
 {
-    // improve sorting! it's too stupid
-    // simple "0 0 0 0 1 2 3 6 7 8 9 11" is not enough
-
     auto &rhs = (const Command &)in;
 
+    // commands without deps must go first
     if (dependencies.size() != rhs.dependencies.size())
         return dependencies.size() < rhs.dependencies.size();
     if (strict_order && rhs.strict_order)
@@ -1048,7 +1370,40 @@ bool Command::lessDuringExecution(const CommandNode &in) const
         return true;
     else if (rhs.strict_order)
         return false;
-    return dependent_commands.size() > dependent_commands.size();
+    if (critical_path != rhs.critical_path)
+        return critical_path > rhs.critical_path;
+    return n_dependent_commands > rhs.n_dependent_commands;
+}
+
+const CommandRecord *Command::findRecord() const
+{
+    if (command_storage != CS_LOCAL && command_storage != CS_GLOBAL)
+        return nullptr;
+    return getCommandStorage(getContext(), command_storage == CS_LOCAL).find(getHash());
+}
+
+std::chrono::milliseconds Command::getExpectedDuration() const
+{
+    auto r = findRecord();
+    if (!r)
+        return {};
+    return r->duration;
+}
+
+PathSet Command::getStoredImplicitInputs() const
+{
+    auto r = findRecord();
+    if (!r)
+        return {};
+    return r->getImplicitInputs(getContext().getCommandStorage().getInternalStorage(command_storage == CS_LOCAL));
+}
+
+uint64_t Command::getExpectedPeakMemory() const
+{
+    auto r = findRecord();
+    if (!r)
+        return 0;
+    return r->peak_memory;
 }
 
 void Command::onBeforeRun() noexcept
@@ -1102,12 +1457,12 @@ void CommandSequence::execute1(std::error_code *ec)
     }
 }
 
-size_t CommandSequence::getHash1() const
+Hash128 CommandSequence::getHash1() const
 {
-    size_t h = 0;
+    Hasher128 h;
     for (auto &c : commands)
-        hash_combine(h, c->getHash());
-    return h;
+        h.update(c->getHash());
+    return h.digest();
 }
 
 void CommandSequence::prepare()
@@ -1162,27 +1517,17 @@ void ExecuteBuiltinCommand::execute1(std::error_code *ec)
         Strings{ sa.begin() + start + 3, sa.end() });
 }
 
-size_t ExecuteBuiltinCommand::getHash1() const
+Hash128 ExecuteBuiltinCommand::getHash1() const
 {
-    size_t h = 0;
+    Hasher128 h;
     // ignore program!
 
     auto start = getFirstResponseFileArgument();
-    hash_combine(h, std::hash<String>()(arguments[start + 1]->toString())); // include function name
-    hash_combine(h, std::hash<String>()(arguments[start + 2]->toString())); // include version
-
-    // must sort arguments first
-    // because some command may generate args in unspecified order
-    std::set<String> args_sorted;
+    h.update(arguments[start + 1]->toString()); // include function name
+    h.update(arguments[start + 2]->toString()); // include version
+    h.update(getArgumentsHash());
 
-    Strings sa;
-    for (auto &a : arguments)
-        args_sorted.insert(a->toString());
-
-    for (auto &a : args_sorted)
-        hash_combine(h, std::hash<String>()(a));
-
-    return h;
+    return h.digest();
 }
 
 String getInternalCallBuiltinFunctionName()
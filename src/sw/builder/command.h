@@ -7,6 +7,8 @@
 #pragma once
 
 #include "node.h"
+#include "path_interner.h"
+#include "stable_hash.h"
 
 #include <primitives/command.h>
 #include <primitives/executor.h>
@@ -65,21 +67,34 @@ namespace sw
 {
 
 struct FileStorage;
+struct JobServer;
 struct Program;
 struct SwBuilderContext;
 
+struct CommandRecord;
+
 struct SW_BUILDER_API CommandNode : std::enable_shared_from_this<CommandNode>
 {
     using SPtr = std::shared_ptr<CommandNode>;
 
+    /// Execution plan copies these sets into its own index based graph
+    /// and uses only that one during execution.
+    /// Sets are kept: same commands may go to several plans (generate, then build)
+    /// and explicit deps cannot be restored from files.
     std::unordered_set<SPtr> dependencies;
-
-    std::atomic_size_t dependencies_left = 0;
+    /// explicit reverse deps, plan turns them into dependencies of the dependent commands
     std::unordered_set<SPtr> dependent_commands;
 
     std::atomic_size_t *current_command = nullptr;
     std::atomic_size_t *total_commands = nullptr;
 
+    // set by execution plan
+
+    // expected time of the longest chain of commands starting from this one
+    // commands with longer chains are executed first
+    uint64_t critical_path = 0;
+    uint32_t n_dependent_commands = 0;
+
     CommandNode();
     CommandNode(const CommandNode &);
     CommandNode &operator=(const CommandNode &);
@@ -89,6 +104,8 @@ struct SW_BUILDER_API CommandNode : std::enable_shared_from_this<CommandNode>
     virtual void execute() = 0;
     virtual void prepare() = 0;
     virtual bool lessDuringExecution(const CommandNode &) const = 0;
+    /// from previous runs, zero if unknown
+    virtual std::chrono::milliseconds getExpectedDuration() const { return {}; }
 
     void clear()
     {
@@ -103,7 +120,9 @@ struct SW_BUILDER_API ResourcePool
     std::condition_variable cv;
     std::mutex m;
 
-    void lock()
+    virtual ~ResourcePool() = default;
+
+    virtual void lock()
     {
         if (n == -1)
             return;
@@ -112,7 +131,7 @@ struct SW_BUILDER_API ResourcePool
         --n;
     }
 
-    void unlock()
+    virtual void unlock()
     {
         if (n == -1)
             return;
@@ -123,6 +142,21 @@ struct SW_BUILDER_API ResourcePool
     }
 };
 
+/// admits commands while sum of their expected peak memory fits into the limit
+struct SW_BUILDER_API MemoryPool
+{
+    uint64_t limit = 0; // bytes, 0 = unlimited
+
+    void acquire(uint64_t sz);
+    void release(uint64_t sz);
+
+private:
+    uint64_t used = 0;
+    size_t running = 0;
+    std::condition_variable cv;
+    std::mutex m;
+};
+
 namespace builder
 {
 
@@ -152,15 +186,16 @@ struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableComman
     String name;
     String name_short;
 
-    Files inputs;
+    // paths are interned, so they are normalized and hashed once per process
+    PathSet inputs;
     // byproducts
     // used only to clean files and pre-create dirs
     //Files intermediate;
     // if some commands accept pairs of args, and specific outputs depend on specific inputs
     // C I1 O1 I2 O2
     // then split that command!
-    Files outputs;
-    Files implicit_inputs;
+    PathSet outputs;
+    PathSet implicit_inputs;
 
     // additional create dirs
     Files output_dirs;
@@ -177,6 +212,12 @@ struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableComman
     bool write_output_to_file = false;
     int strict_order = 0; // used to execute this before other commands
     ResourcePool *pool = nullptr;
+    JobServer *jobserver = nullptr; // token is held while program is running
+    MemoryPool *memory_pool = nullptr;
+    uint64_t peak_memory = 0; // of the last run, bytes
+    // command may be executed on remote workers when set,
+    // worker passes it with its scratch dir to make outputs look like local ones
+    String remote_prefix_map_option;
 
     std::thread::id tid;
     Clock::time_point t_begin;
@@ -205,6 +246,9 @@ struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableComman
     virtual ~Command();
 
     void prepare() override;
+    /// Execution plan prepares other commands in parallel.
+    /// Pipes prepare each other, user code is not thread safe.
+    virtual bool isPreparedSerially() const { return prev || next; }
     void execute() override;
     void execute(std::error_code &ec) override;
     void clean() const;
@@ -228,13 +272,18 @@ struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableComman
     path redirectStdin(const path &p);
     path redirectStdout(const path &p, bool append = false);
     path redirectStderr(const path &p, bool append = false);
-    size_t getHash() const;
+    Hash128 getHash() const;
     void addPathDirectory(const path &p);
     Files getGeneratedDirs() const; // used by generators
     void addInputOutputDeps();
     path writeCommand(const path &basename) const;
 
     bool lessDuringExecution(const CommandNode &rhs) const override;
+    std::chrono::milliseconds getExpectedDuration() const override;
+    /// from previous runs, zero if unknown
+    uint64_t getExpectedPeakMemory() const;
+    /// from previous run
+    PathSet getStoredImplicitInputs() const;
 
     void onBeforeRun() noexcept override;
     void onEnd() noexcept override;
@@ -257,24 +306,37 @@ protected:
     bool executed_ = false;
 
     virtual bool check_if_file_newer(const path &, const String &what, bool throw_on_missing) const;
+    Hash128 getArgumentsHash() const;
+    /// runs local process, skipped for up to date, cached and remotely executed commands
+    virtual void execute1(std::error_code *ec = nullptr);
 
 private:
     const SwBuilderContext *swctx = nullptr;
-    mutable size_t hash = 0;
+    mutable Hash128 hash;
     Arguments rsp_args;
     mutable String log_string;
+    bool restored_from_cache = false;
 
-    virtual void execute1(std::error_code *ec = nullptr);
-    virtual size_t getHash1() const;
+    virtual Hash128 getHash1() const;
 
     void postProcess(bool ok = true);
     virtual void postProcess1(bool ok) {}
 
     bool beforeCommand();
     void afterCommand();
+    std::unique_lock<ResourcePool> acquireJobToken();
+    std::shared_ptr<void> acquireMemory();
     bool isTimeChanged() const;
+    bool isContentChanged(CommandRecord &) const;
+    uint64_t getContentHash() const;
+    uint64_t getFileContentHash(PathId) const;
+    const CommandRecord *findRecord() const;
+    bool isCacheable() const;
+    bool restoreOutputs();
+    void storeOutputs();
+    bool executeRemotely();
     void printLog() const;
-    size_t getHashAndSave() const;
+    Hash128 getHashAndSave() const;
     String makeErrorString();
     String makeErrorString(const String &e);
     String saveCommand() const;
@@ -301,7 +363,7 @@ private:
     std::vector<std::shared_ptr<Command>> commands;
 
     void execute1(std::error_code *ec = nullptr) override;
-    size_t getHash1() const override;
+    Hash128 getHash1() const override;
     void prepare() override;
 };
 
@@ -321,7 +383,7 @@ struct SW_BUILDER_API ExecuteBuiltinCommand : Command
 
 private:
     void execute1(std::error_code *ec = nullptr) override;
-    size_t getHash1() const override;
+    Hash128 getHash1() const override;
     void prepare() override {}
 };
 
@@ -355,7 +417,7 @@ template<> struct hash<sw::builder::Command>
 {
     size_t operator()(const sw::builder::Command &c) const
     {
-        return c.getHash();
+        return std::hash<sw::Hash128>()(c.getHash());
     }
 };
 
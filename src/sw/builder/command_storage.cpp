@@ -11,6 +11,10 @@
 
 #include <sw/manager/storage.h>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/thread/lock_types.hpp>
 #include <primitives/emitter.h>
 #include <primitives/date_time.h>
@@ -19,14 +23,29 @@
 #include <primitives/lock.h>
 #include <primitives/symbol.h>
 
+#include <map>
+#include <random>
+#include <set>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "db_file");
 
-#define COMMAND_DB_FORMAT_VERSION 4
+#define COMMAND_DB_FORMAT_VERSION 11
+
+namespace bip = boost::interprocess;
 
 namespace sw
 {
 
+static const String log_prefix = "cmd_log_";
+static const String log_suffix = ".bin";
+
 static path getCurrentModuleName()
 {
     return primitives::getModuleNameForSymbol(primitives::getCurrentModuleSymbol());
@@ -44,15 +63,71 @@ static path getDir(const SwBuilderContext &swctx, bool local)
     return swctx.getLocalStorage().storage_dir_tmp / "db" / "0.3.1";
 }
 
-static path getCommandsDbFilename(const SwBuilderContext &swctx, bool local)
+static path getCommandsDbFilename(const path &dir)
 {
-    return getDir(swctx, local) / std::to_string(COMMAND_DB_FORMAT_VERSION) / "commands.bin";
+    return dir / "commands.bin";
 }
 
-static path getCommandsLogFileName(const SwBuilderContext &swctx, bool local)
+static path getOwnLogFileName()
 {
+    // every process writes its own log, it is never appended after close
+    static const auto id = std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) +
+        "_" + std::to_string(std::random_device()());
     auto cfg = shorten_hash(blake2b_512(getCurrentModuleNameHash()), 12);
-    return getDir(swctx, local) / std::to_string(COMMAND_DB_FORMAT_VERSION) / ("cmd_log_" + cfg + ".bin");
+    return log_prefix + cfg + "_" + id + log_suffix;
+}
+
+static path getCommandsLogFileName(const SwBuilderContext &swctx, bool local)
+{
+    return getDir(swctx, local) / std::to_string(COMMAND_DB_FORMAT_VERSION) / getOwnLogFileName();
+}
+
+static path getLockFileName(const path &fn)
+{
+    return path(fn) += ".lock";
+}
+
+// sorted by time, so newer records override older ones
+static std::vector<path> getLogs(const path &dir)
+{
+    std::vector<std::pair<fs::file_time_type, path>> logs;
+    error_code ec;
+    for (auto &e : fs::directory_iterator(dir, ec))
+    {
+        auto &p = e.path();
+        if (p.extension() != log_suffix || p.filename().u8string().rfind(log_prefix, 0) != 0)
+            continue;
+        auto t = fs::last_write_time(p, ec);
+        if (!ec)
+            logs.emplace_back(t, p);
+    }
+    std::sort(logs.begin(), logs.end());
+    std::vector<path> r;
+    for (auto &[_, p] : logs)
+        r.push_back(p);
+    return r;
+}
+
+// fnv-1a, stable between builds of the program
+static uint64_t checksum(const uint8_t *p, size_t sz)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < sz; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void syncFile(FILE *f)
+{
+    fflush(f);
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
 }
 
 template <class T>
@@ -63,48 +138,449 @@ static void write_int(std::vector<uint8_t> &vec, T val)
     memcpy(&vec[sz], &val, sizeof(val));
 }
 
-static void write_str(std::vector<uint8_t> &vec, const String &val)
+namespace
+{
+
+struct Reader
 {
-    auto sz = val.size() + 1;
-    //write_int(vec, sz);
-    auto vsz = vec.size();
-    vec.resize(vsz + sz);
-    memcpy(&vec[vsz], &val[0], sz);
+    const uint8_t *p;
+    const uint8_t *end;
+
+    template <class T>
+    bool read(T &v)
+    {
+        if (end - p < (ptrdiff_t)sizeof(v))
+            return false;
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return true;
+    }
+};
+
+enum class LogRecordType : uint32_t
+{
+    Command,
+    File,
+    FileSet,
+    FileHash,
+};
+
+struct LogRecordHeader
+{
+    uint32_t size;
+    LogRecordType type;
+    uint64_t checksum;
+};
+
 }
 
-Files CommandRecord::getImplicitInputs(detail::Storage &s) const
+static bool readRecord(const uint8_t *p, size_t sz, CommandRecord &r)
 {
-    Files files;
-    for (auto &h : implicit_inputs)
+    Reader b{ p, p + sz };
+    if (!b.read(r.hash))
+        return false;
+#ifndef __APPLE__
+    time_t m;
+    if (!b.read(m))
+        return false;
+    r.mtime = time_t2file_time_type(m);
+#else
+    __int128_t m;
+    if (!b.read(m))
+        return false;
+    r.mtime = *(fs::file_time_type*)&m;
+#endif
+    int64_t d;
+    if (!b.read(d) || !b.read(r.peak_memory) || !b.read(r.content_hash))
+        return false;
+    r.duration = std::chrono::milliseconds(d);
+    return b.read(r.implicit_inputs_set);
+}
+
+static bool readFileHash(const uint8_t *p, size_t sz, FileHashRecord &r)
+{
+    Reader b{ p, p + sz };
+    return b.read(r.file) && b.read(r.mtime) && b.read(r.size) && b.read(r.hash);
+}
+
+// set id, then file hashes
+static bool readSet(const uint8_t *p, size_t sz, size_t &id, std::vector<Hash128> &files)
+{
+    if (sz < sizeof(id) || (sz - sizeof(id)) % sizeof(Hash128))
+        return false;
+    memcpy(&id, p, sizeof(id));
+    files.resize((sz - sizeof(id)) / sizeof(Hash128));
+    memcpy(files.data(), p + sizeof(id), sz - sizeof(id));
+    return true;
+}
+
+// same as PathInterner::getHash(), compaction works with strings only
+static Hash128 getFileHash(const String &normalized_path)
+{
+    return Hasher128().update(normalized_path).digest();
+}
+
+// sets share segment index type with commands and files
+static Hash128 getSetKey(size_t id)
+{
+    return { id, 0 };
+}
+
+static size_t getStorageKey(const Hash128 &h)
+{
+    return h.lo ? h.lo : 1;
+}
+
+// first probe of set id, taken ids are checked by contents
+static size_t getSetHash(const std::vector<Hash128> &sorted_files)
+{
+    auto h = checksum((const uint8_t *)sorted_files.data(), sorted_files.size() * sizeof(sorted_files[0]));
+    return h ? h : 1;
+}
+
+static void appendLogRecord(std::vector<uint8_t> &v, LogRecordType t, const void *data, size_t sz)
+{
+    LogRecordHeader h{ (uint32_t)sz, t, checksum((const uint8_t *)data, sz) };
+    auto vsz = v.size();
+    v.resize(vsz + sizeof(h) + sz);
+    memcpy(&v[vsz], &h, sizeof(h));
+    memcpy(&v[vsz + sizeof(h)], data, sz);
+}
+
+// stops at torn tail
+template <class F>
+static void readLog(const path &fn, F &&f)
+{
+    auto s = read_file(fn);
+    auto p = (const uint8_t *)s.data();
+    auto end = p + s.size();
+    while (end - p >= (ptrdiff_t)sizeof(LogRecordHeader))
     {
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-            throw SW_RUNTIME_ERROR("no such file");
-        auto p = i->second;
-        lk.unlock();
-        if (!p.empty())
-            files.insert(p);
+        LogRecordHeader h;
+        memcpy(&h, p, sizeof(h));
+        p += sizeof(h);
+        if (end - p < (ptrdiff_t)h.size || checksum(p, h.size) != h.checksum)
+        {
+            LOG_DEBUG(logger, "Broken tail of command log: " << normalize_path(fn));
+            break;
+        }
+        f(h.type, p, h.size);
+        p += h.size;
+    }
+}
+
+namespace detail
+{
+
+struct FileLock
+{
+    bip::file_lock l;
+
+    FileLock(const path &fn)
+    {
+        if (!fs::exists(fn))
+            write_file(fn, "");
+        l = bip::file_lock(fn.string().c_str());
+    }
+};
+
+struct SegmentHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t n_commands;
+    uint64_t commands_index;
+    uint64_t n_files;
+    uint64_t files_index;
+    uint64_t n_sets;
+    uint64_t sets_index;
+    uint64_t n_file_hashes;
+    uint64_t file_hashes_index;
+};
+
+struct SegmentIndexEntry
+{
+    Hash128 hash;
+    uint64_t offset; // of record size, then record
+};
+
+static const char segment_magic[8] = "SWCMDDB";
+
+// compacted immutable file: header, records, sorted indices
+struct Segment
+{
+    bip::file_mapping f;
+    bip::mapped_region r;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    const SegmentIndexEntry *commands = nullptr;
+    size_t n_commands = 0;
+    const SegmentIndexEntry *files = nullptr;
+    size_t n_files = 0;
+    const SegmentIndexEntry *sets = nullptr;
+    size_t n_sets = 0;
+    const SegmentIndexEntry *file_hashes = nullptr;
+    size_t n_file_hashes = 0;
+
+    /// nullptr when missing or broken
+    static std::unique_ptr<Segment> open(const path &fn)
+    {
+        error_code ec;
+        auto sz = fs::file_size(fn, ec);
+        if (ec || sz < sizeof(SegmentHeader))
+            return {};
+
+        auto s = std::make_unique<Segment>();
+        try
+        {
+            s->f = bip::file_mapping(fn.string().c_str(), bip::read_only);
+            s->r = bip::mapped_region(s->f, bip::read_only);
+        }
+        catch (bip::interprocess_exception &e)
+        {
+            LOG_WARN(logger, "Cannot map command db " << normalize_path(fn) << ": " << e.what());
+            return {};
+        }
+        s->data = (const uint8_t *)s->r.get_address();
+        s->size = s->r.get_size();
+
+        SegmentHeader h;
+        memcpy(&h, s->data, sizeof(h));
+        auto fits = [&s](uint64_t off, uint64_t n)
+        {
+            return off % alignof(SegmentIndexEntry) == 0 && off <= s->size &&
+                n <= (s->size - off) / sizeof(SegmentIndexEntry);
+        };
+        if (memcmp(h.magic, segment_magic, sizeof(h.magic)) != 0 ||
+            h.version != COMMAND_DB_FORMAT_VERSION ||
+            !fits(h.commands_index, h.n_commands) ||
+            !fits(h.files_index, h.n_files) ||
+            !fits(h.sets_index, h.n_sets) ||
+            !fits(h.file_hashes_index, h.n_file_hashes))
+        {
+            LOG_WARN(logger, "Command db is broken, ignoring: " << normalize_path(fn));
+            return {};
+        }
+        s->commands = (const SegmentIndexEntry *)(s->data + h.commands_index);
+        s->n_commands = h.n_commands;
+        s->files = (const SegmentIndexEntry *)(s->data + h.files_index);
+        s->n_files = h.n_files;
+        s->sets = (const SegmentIndexEntry *)(s->data + h.sets_index);
+        s->n_sets = h.n_sets;
+        s->file_hashes = (const SegmentIndexEntry *)(s->data + h.file_hashes_index);
+        s->n_file_hashes = h.n_file_hashes;
+        return s;
+    }
+
+    const uint8_t *get(const SegmentIndexEntry &e, size_t &sz) const
+    {
+        uint64_t rsz;
+        if (e.offset > size || size - e.offset < sizeof(rsz))
+            return nullptr;
+        memcpy(&rsz, data + e.offset, sizeof(rsz));
+        if (size - e.offset - sizeof(rsz) < rsz)
+            return nullptr;
+        sz = rsz;
+        return data + e.offset + sizeof(rsz);
+    }
+
+    const uint8_t *find(const SegmentIndexEntry *idx, size_t n, const Hash128 &h, size_t &sz) const
+    {
+        auto i = std::lower_bound(idx, idx + n, h, [](const auto &e, const auto &h) { return e.hash < h; });
+        if (i == idx + n || i->hash != h)
+            return nullptr;
+        return get(*i, sz);
+    }
+
+    bool hasFile(const Hash128 &h) const
+    {
+        size_t sz;
+        return find(files, n_files, h, sz);
+    }
+
+    bool hasSet(size_t id) const
+    {
+        size_t sz;
+        return find(sets, n_sets, getSetKey(id), sz);
+    }
+};
+
+}
+
+static std::unique_ptr<detail::FileLock> lockFile(const path &fn)
+{
+    auto l = std::make_unique<detail::FileLock>(fn);
+    l->l.lock();
+    return l;
+}
+
+PathSet CommandRecord::getImplicitInputs(detail::Storage &s) const
+{
+    PathSet files;
+    if (!implicit_inputs_set)
+        return files;
+    auto &pi = getPathInterner();
+    for (auto &h : s.getSet(implicit_inputs_set))
+    {
+        auto id = s.getFile(h);
+        if (!pi.getString(id).empty())
+            files.insertId(id);
     }
     return files;
 }
 
-void CommandRecord::setImplicitInputs(const Files &files, detail::Storage &s)
+void CommandRecord::setImplicitInputs(const PathSet &files, detail::Storage &s)
 {
-    for (auto &f : files)
+    auto &pi = getPathInterner();
+    std::vector<Hash128> hashes;
+    hashes.reserve(files.size());
+    for (auto id : files.getIds())
     {
-        auto str = normalize_path(f);
-        auto h = std::hash<String>()(str);
-        implicit_inputs.insert(h);
+        auto &h = pi.getHash(id);
+        hashes.push_back(h);
 
         boost::upgrade_lock lk(s.m_file_storage_by_hash);
         auto i = s.file_storage_by_hash.find(h);
         if (i == s.file_storage_by_hash.end())
         {
             boost::upgrade_to_unique_lock lk2(lk);
-            s.file_storage_by_hash[h] = str;
+            s.file_storage_by_hash[h] = id;
         }
     }
+    implicit_inputs_set = s.addSet(std::move(hashes));
+}
+
+detail::Storage::Storage() = default;
+detail::Storage::~Storage() = default;
+
+CommandRecord *detail::Storage::find(const Hash128 &h)
+{
+    auto k = getStorageKey(h);
+    if (auto r = storage.find(k))
+        return r->hash == h ? r : nullptr;
+    if (!db)
+        return nullptr;
+
+    // copy on first access, so record could be updated
+    size_t sz;
+    auto p = db->find(db->commands, db->n_commands, h, sz);
+    if (!p)
+        return nullptr;
+    CommandRecord r;
+    if (!readRecord(p, sz, r) || r.hash != h)
+        return nullptr;
+    auto i = storage.insert(k, r).first;
+    return i->hash == h ? i : nullptr;
+}
+
+ConcurrentCommandStorage::insert_type detail::Storage::insert(const Hash128 &h)
+{
+    if (auto r = find(h))
+        return { r, false };
+    auto i = storage.insert(getStorageKey(h));
+    if (!i.second && i.first->hash && i.first->hash != h)
+    {
+        // other command with the same key, take its place,
+        // so it is rebuilt instead of silently skipping this one
+        *i.first = CommandRecord{};
+        return { i.first, true };
+    }
+    return i;
+}
+
+bool detail::Storage::hasFile(const Hash128 &h) const
+{
+    {
+        boost::shared_lock lk(m_file_storage_by_hash);
+        if (file_storage_by_hash.find(h) != file_storage_by_hash.end())
+            return true;
+    }
+    return db && db->hasFile(h);
+}
+
+PathId detail::Storage::getFile(const Hash128 &h) const
+{
+    {
+        boost::shared_lock lk(m_file_storage_by_hash);
+        auto i = file_storage_by_hash.find(h);
+        if (i != file_storage_by_hash.end())
+            return i->second;
+    }
+    size_t sz;
+    if (db)
+    {
+        if (auto p = db->find(db->files, db->n_files, h, sz))
+            return getPathInterner().intern(String((const char *)p, sz));
+    }
+    throw SW_RUNTIME_ERROR("no such file");
+}
+
+size_t detail::Storage::addSet(std::vector<Hash128> files)
+{
+    if (files.empty())
+        return 0;
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    for (auto id = getSetHash(files);; id = id + 1 ? id + 1 : 1)
+    {
+        if (hasSet(id))
+        {
+            if (getSet(id) == files)
+                return id;
+            continue;
+        }
+
+        boost::unique_lock lk(m_sets);
+        auto [i, inserted] = sets.try_emplace(id, std::move(files));
+        // other thread could take this id
+        if (inserted || i->second == files)
+            return id;
+    }
+}
+
+bool detail::Storage::hasSet(size_t id) const
+{
+    {
+        boost::shared_lock lk(m_sets);
+        if (sets.find(id) != sets.end())
+            return true;
+    }
+    return db && db->hasSet(id);
+}
+
+const std::vector<Hash128> &detail::Storage::getSet(size_t id)
+{
+    {
+        boost::shared_lock lk(m_sets);
+        auto i = sets.find(id);
+        if (i != sets.end())
+            return i->second;
+    }
+
+    // copy on first access
+    size_t sz, id2;
+    std::vector<Hash128> files;
+    const uint8_t *p = db ? db->find(db->sets, db->n_sets, getSetKey(id), sz) : nullptr;
+    if (!p || !readSet(p, sz, id2, files))
+        throw SW_RUNTIME_ERROR("no such file set");
+    boost::unique_lock lk(m_sets);
+    return sets.emplace(id, std::move(files)).first->second;
+}
+
+bool detail::Storage::findFileHash(const Hash128 &file, FileHashRecord &r) const
+{
+    {
+        boost::shared_lock lk(m_file_hashes);
+        auto i = file_hashes.find(file);
+        if (i != file_hashes.end())
+        {
+            r = i->second;
+            return true;
+        }
+    }
+    size_t sz;
+    const uint8_t *p = db ? db->find(db->file_hashes, db->n_file_hashes, file, sz) : nullptr;
+    return p && readFileHash(p, sz, r) && r.file == file;
 }
 
 FileDb::FileDb(const SwBuilderContext &swctx)
@@ -112,11 +588,16 @@ FileDb::FileDb(const SwBuilderContext &swctx)
 {
 }
 
-void FileDb::write(std::vector<uint8_t> &v, const CommandRecord &f, const detail::Storage &s)
+path FileDb::getDir(bool local) const
+{
+    return sw::getDir(swctx, local) / std::to_string(COMMAND_DB_FORMAT_VERSION);
+}
+
+void FileDb::write(std::vector<uint8_t> &v, const CommandRecord &f)
 {
     v.clear();
 
-    if (f.hash == 0)
+    if (!f.hash)
         return;
 
     //if (!std::is_trivially_copyable_v<decltype(f.mtime)>)
@@ -128,161 +609,350 @@ void FileDb::write(std::vector<uint8_t> &v, const CommandRecord &f, const detail
 #else
     write_int(v, *(__int128_t*)&f.mtime);
 #endif
-
-    auto n = f.implicit_inputs.size();
-    write_int(v, n);
-    for (auto &h : f.implicit_inputs)
-    {
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-            throw SW_RUNTIME_ERROR("no such file");
-        auto p = i->second;
-        lk.unlock();
-        write_int(v, std::hash<String>()(normalize_path(p)));
-    }
+    write_int(v, (int64_t)f.duration.count());
+    write_int(v, f.peak_memory);
+    write_int(v, f.content_hash);
+    write_int(v, f.implicit_inputs_set);
 }
 
-static String getFilesSuffix()
+void FileDb::write(std::vector<uint8_t> &v, const FileHashRecord &f)
 {
-    return ".files";
+    v.clear();
+    write_int(v, f.file);
+    write_int(v, f.mtime);
+    write_int(v, f.size);
+    write_int(v, f.hash);
 }
 
-static void load(const path &fn, Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands)
+void FileDb::writeLogRecord(std::vector<uint8_t> &v, const CommandRecord &r)
 {
-    // files
-    if (fs::exists(path(fn) += getFilesSuffix()))
-    {
-        primitives::BinaryStream b;
-        b.load(path(fn) += getFilesSuffix());
-        while (!b.eof())
-        {
-            size_t sz; // record size
-            b.read(sz);
-            if (!b.has(sz))
-            {
-                fs::resize_file(path(fn) += getFilesSuffix(), b.index() - sizeof(sz));
-                break; // record is in bad shape
-            }
-
-            if (sz == 0)
-                continue;
+    std::vector<uint8_t> data;
+    write(data, r);
+    appendLogRecord(v, LogRecordType::Command, data.data(), data.size());
+}
 
-            String s;
-            b.read(s);
-            files.insert(s);
+void FileDb::load(detail::Storage &s, bool local) const
+{
+    load(s, getDir(local));
+}
 
-            files2[std::hash<String>()(s)] = s;
-        }
-    }
+void FileDb::load(detail::Storage &s, const path &dir)
+{
+    // segment is not read here, only mapped
+    s.db = detail::Segment::open(getCommandsDbFilename(dir));
 
-    // commands
-    if (fs::exists(fn))
+    // logs are small, they are merged into segment from time to time
+    std::unordered_map<Hash128, CommandRecord> commands;
+    // same id given to different sets by concurrent processes
+    std::unordered_set<size_t> conflicting_sets;
+    for (auto &fn : getLogs(dir))
     {
-        primitives::BinaryStream b;
-        b.load(fn);
-        while (!b.eof())
+        readLog(fn, [&s, &commands, &conflicting_sets](auto type, auto p, auto sz)
         {
-            size_t sz; // record size
-            b.read(sz);
-            if (!b.has(sz))
+            switch (type)
+            {
+            case LogRecordType::File:
             {
-                fs::resize_file(path(fn) += getFilesSuffix(), b.index() - sizeof(sz));
-                break; // record is in bad shape
+                String f((const char *)p, sz);
+                auto id = getPathInterner().intern(f);
+                auto h = getPathInterner().getHash(id);
+                s.file_storage_by_hash[h] = id;
+                s.logged_files.insert(h);
+                break;
             }
-
-            if (sz == 0)
-                continue;
-
-            size_t h;
-            b.read(h);
-
-            auto r = commands.insert(h);
-            r.first->hash = h;
-
-            //if (!std::is_trivially_copyable_v<decltype(r.first->mtime)>)
-                //throw SW_RUNTIME_ERROR("x");
-
-#ifndef __APPLE__
-            time_t m;
-            b.read(m);
-            r.first->mtime = time_t2file_time_type(m);
-#else
-            __int128_t m;
-            b.read(m);
-            r.first->mtime = *(fs::file_time_type*)&m;
-#endif
-
-            size_t n;
-            b.read(n);
-            r.first->implicit_inputs.reserve(n);
-            while (n--)
+            case LogRecordType::FileSet:
             {
-                b.read(h);
-                auto &f = files2[h];
-                if (!f.empty())
+                size_t id;
+                std::vector<Hash128> files;
+                if (readSet(p, sz, id, files))
                 {
-                    //r.first->implicit_inputs.insert(files2[h]);
-                    r.first->implicit_inputs.insert(h);
+                    size_t dsz;
+                    auto d = s.db ? s.db->find(s.db->sets, s.db->n_sets, getSetKey(id), dsz) : nullptr;
+                    auto i = s.sets.find(id);
+                    if ((i != s.sets.end() && i->second != files) || (d && (dsz != sz || memcmp(d, p, sz))))
+                        conflicting_sets.insert(id);
+                    s.sets[id] = std::move(files);
+                    s.logged_sets.insert(id);
                 }
+                break;
+            }
+            case LogRecordType::Command:
+            {
+                CommandRecord r;
+                if (readRecord(p, sz, r) && r.hash)
+                    commands[r.hash] = std::move(r);
+                break;
+            }
+            case LogRecordType::FileHash:
+            {
+                FileHashRecord r;
+                if (readFileHash(p, sz, r))
+                    s.file_hashes[r.file] = r;
+                break;
             }
+            }
+        });
+    }
+
+    for (auto id : conflicting_sets)
+    {
+        s.sets.erase(id);
+        s.logged_sets.erase(id);
+    }
+
+    // files are written before sets and sets before commands, but logs could be damaged
+    for (auto i = s.sets.begin(); i != s.sets.end();)
+    {
+        if (std::all_of(i->second.begin(), i->second.end(), [&s](auto h) { return s.hasFile(h); }))
+        {
+            ++i;
+            continue;
         }
+        s.logged_sets.erase(i->first);
+        i = s.sets.erase(i);
+    }
+    for (auto &[h, r] : commands)
+    {
+        if (!r.implicit_inputs_set || (s.hasSet(r.implicit_inputs_set) && !conflicting_sets.count(r.implicit_inputs_set)))
+            s.storage.insert(getStorageKey(h), r);
     }
 }
 
-void FileDb::load(Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands, bool local) const
+bool FileDb::needsCompaction(const path &dir)
 {
-    sw::load(getCommandsDbFilename(swctx, local), files, files2, commands);
-    sw::load(getCommandsLogFileName(swctx, local), files, files2, commands);
+    error_code ec;
+    uintmax_t logs_size = 0;
+    auto logs = getLogs(dir);
+    for (auto &l : logs)
+    {
+        auto sz = fs::file_size(l, ec);
+        if (!ec)
+            logs_size += sz;
+    }
+    auto db_size = fs::file_size(getCommandsDbFilename(dir), ec);
+    if (ec)
+        db_size = 0;
+    // logs are parsed on every start, segment is not
+    return logs.size() > 32 || logs_size > std::max<uintmax_t>(4 << 20, db_size / 8);
 }
 
-void FileDb::save(const Files &files, const detail::Storage &s, ConcurrentCommandStorage &commands, bool local) const
+bool FileDb::compact(const path &dir, const std::atomic_bool &stop)
 {
-    std::vector<uint8_t> v;
+    // one compaction at a time
+    detail::FileLock compaction_lock(dir / "compaction.lock");
+    bip::scoped_lock<bip::file_lock> lk(compaction_lock.l, bip::try_to_lock);
+    if (!lk.owns())
+        return false;
 
-    // files
+    // only closed logs, live ones are still written
+    // own log is skipped explicitly, because posix locks are per process
+    auto own = getOwnLogFileName();
+    std::vector<path> logs;
+    std::vector<std::unique_ptr<detail::FileLock>> log_locks;
+    for (auto &l : getLogs(dir))
     {
-        primitives::BinaryStream b(10'000'000); // reserve amount
-        for (auto &f : files)
+        if (l.filename() == own)
+            continue;
+        auto lf = getLockFileName(l);
+        if (fs::exists(lf))
         {
-            auto s = normalize_path(f);
-            auto sz = s.size() + 1;
-            b.write(sz);
-            b.write(s);
+            auto fl = std::make_unique<detail::FileLock>(lf);
+            if (!fl->l.try_lock())
+                continue;
+            log_locks.push_back(std::move(fl));
         }
-        if (!b.empty())
+        logs.push_back(l);
+    }
+    if (logs.empty())
+        return false;
+
+    LOG_TRACE(logger, "Compacting command db: " << normalize_path(dir));
+
+    auto old = detail::Segment::open(getCommandsDbFilename(dir));
+
+    // commands start with their hash, sets with their id
+    std::map<Hash128, String> log_commands, log_files, log_sets, log_file_hashes;
+    std::set<Hash128> conflicting_sets;
+    for (auto &l : logs)
+    {
+        if (stop)
+            return false;
+        readLog(l, [&log_commands, &log_files, &log_sets, &log_file_hashes, &conflicting_sets](auto type, auto p, auto sz)
         {
-            auto p = getCommandsDbFilename(swctx, local) += getFilesSuffix();
-            fs::create_directories(p.parent_path());
-            b.save(p);
-        }
+            String v((const char *)p, sz);
+            if (type == LogRecordType::File)
+            {
+                log_files[getFileHash(v)] = std::move(v);
+                return;
+            }
+            if (type == LogRecordType::FileSet)
+            {
+                size_t id;
+                if (sz < sizeof(id) || (memcpy(&id, p, sizeof(id)), !id))
+                    return;
+                auto [i, inserted] = log_sets.emplace(getSetKey(id), v);
+                if (!inserted && i->second != v)
+                    conflicting_sets.insert(i->first);
+            }
+            else if (type == LogRecordType::Command)
+            {
+                Hash128 h;
+                if (sz < sizeof(h) || (memcpy(&h, p, sizeof(h)), !h))
+                    return;
+                log_commands[h] = std::move(v);
+            }
+            else if (type == LogRecordType::FileHash)
+            {
+                FileHashRecord r;
+                if (readFileHash(p, sz, r))
+                    log_file_hashes[r.file] = std::move(v);
+            }
+        });
     }
 
-    // commands
+    // drop sets with unknown files and commands with unknown sets, they will be rebuilt
+    for (auto i = log_sets.begin(); i != log_sets.end();)
     {
-        primitives::BinaryStream b(10'000'000); // reserve amount
-        for (const auto &[k, r] : commands)
+        size_t id;
+        std::vector<Hash128> files;
+        bool ok = readSet((const uint8_t *)i->second.data(), i->second.size(), id, files);
+        for (auto h : files)
+            ok = ok && (log_files.count(h) || (old && old->hasFile(h)));
+        size_t osz;
+        auto o = old ? old->find(old->sets, old->n_sets, i->first, osz) : nullptr;
+        if (conflicting_sets.count(i->first) || (o && String((const char *)o, osz) != i->second))
         {
-            write(v, r, s);
-            auto sz = v.size();
-            b.write(sz);
-            b.write(v.data(), v.size());
+            conflicting_sets.insert(i->first);
+            ok = false;
         }
-        if (!b.empty())
+        if (ok)
+            ++i;
+        else
+            i = log_sets.erase(i);
+    }
+    for (auto i = log_commands.begin(); i != log_commands.end();)
+    {
+        CommandRecord r;
+        bool ok = readRecord((const uint8_t *)i->second.data(), i->second.size(), r);
+        ok = ok && (!r.implicit_inputs_set || log_sets.count(getSetKey(r.implicit_inputs_set)) || (old && old->hasSet(r.implicit_inputs_set)));
+        ok = ok && !conflicting_sets.count(getSetKey(r.implicit_inputs_set));
+        if (ok)
+            ++i;
+        else
+            i = log_commands.erase(i);
+    }
+
+    auto fn = getCommandsDbFilename(dir);
+    auto tmp = path(fn) += ".tmp";
+    bool stopped = false;
+    {
+        ScopedFile f(tmp, "wb");
+        auto h = f.getHandle();
+
+        detail::SegmentHeader sh{};
+        memcpy(sh.magic, detail::segment_magic, sizeof(sh.magic));
+        sh.version = COMMAND_DB_FORMAT_VERSION;
+        fwrite(&sh, sizeof(sh), 1, h);
+        uint64_t off = sizeof(sh);
+
+        auto put = [h, &off](auto &idx, const Hash128 &hash, const void *p, uint64_t sz)
         {
-            auto p = getCommandsDbFilename(swctx, local);
-            fs::create_directories(p.parent_path());
-            b.save(p);
+            idx.push_back({ hash, off });
+            fwrite(&sz, sizeof(sz), 1, h);
+            fwrite(p, sz, 1, h);
+            off += sizeof(sz) + sz;
+        };
+
+        // both sides are sorted by hash, logs win
+        auto merge = [&old, &put, &stop, &stopped](const detail::SegmentIndexEntry *oi, size_t on,
+            const std::map<Hash128, String> &m, std::vector<detail::SegmentIndexEntry> &idx)
+        {
+            auto i = m.begin();
+            size_t j = 0;
+            while (j < on || i != m.end())
+            {
+                if ((j & 0xFFFF) == 0 && stop)
+                {
+                    stopped = true;
+                    return;
+                }
+                if (i != m.end() && (j == on || !(oi[j].hash < i->first)))
+                {
+                    if (j < on && oi[j].hash == i->first)
+                        j++;
+                    put(idx, i->first, i->second.data(), i->second.size());
+                    ++i;
+                    continue;
+                }
+                size_t sz;
+                if (auto p = old->get(oi[j], sz))
+                    put(idx, oi[j].hash, p, sz);
+                j++;
+            }
+        };
+
+        std::vector<detail::SegmentIndexEntry> commands_index, files_index, sets_index, file_hashes_index;
+        merge(old ? old->files : nullptr, old ? old->n_files : 0, log_files, files_index);
+        merge(old ? old->sets : nullptr, old ? old->n_sets : 0, log_sets, sets_index);
+        merge(old ? old->commands : nullptr, old ? old->n_commands : 0, log_commands, commands_index);
+        merge(old ? old->file_hashes : nullptr, old ? old->n_file_hashes : 0, log_file_hashes, file_hashes_index);
+
+        if (!stopped)
+        {
+            // align indices
+            static const char zeros[alignof(detail::SegmentIndexEntry)] = {};
+            auto pad = (alignof(detail::SegmentIndexEntry) - off % alignof(detail::SegmentIndexEntry)) % alignof(detail::SegmentIndexEntry);
+            fwrite(zeros, pad, 1, h);
+            off += pad;
+
+            sh.n_files = files_index.size();
+            sh.files_index = off;
+            fwrite(files_index.data(), sizeof(files_index[0]), files_index.size(), h);
+            off += files_index.size() * sizeof(files_index[0]);
+
+            sh.n_sets = sets_index.size();
+            sh.sets_index = off;
+            fwrite(sets_index.data(), sizeof(sets_index[0]), sets_index.size(), h);
+            off += sets_index.size() * sizeof(sets_index[0]);
+
+            sh.n_commands = commands_index.size();
+            sh.commands_index = off;
+            fwrite(commands_index.data(), sizeof(commands_index[0]), commands_index.size(), h);
+            off += commands_index.size() * sizeof(commands_index[0]);
+
+            sh.n_file_hashes = file_hashes_index.size();
+            sh.file_hashes_index = off;
+            fwrite(file_hashes_index.data(), sizeof(file_hashes_index[0]), file_hashes_index.size(), h);
+
+            fseek(h, 0, SEEK_SET);
+            fwrite(&sh, sizeof(sh), 1, h);
+            syncFile(h);
+            if (ferror(h))
+                throw SW_RUNTIME_ERROR("Cannot write command db: " + normalize_path(tmp));
         }
     }
 
     error_code ec;
-    fs::remove(getCommandsLogFileName(swctx, local), ec);
-    fs::remove(getCommandsLogFileName(swctx, local) += getFilesSuffix(), ec);
+    if (stopped)
+    {
+        fs::remove(tmp, ec);
+        return false;
+    }
+
+    // replace atomically, then drop merged logs
+    // crash in between is fine, logs are merged again next time
+    old.reset();
+    fs::rename(tmp, fn);
+    for (auto &l : logs)
+        fs::remove(l, ec);
+    log_locks.clear();
+    for (auto &l : logs)
+        fs::remove(getLockFileName(l), ec);
+    return true;
 }
 
 detail::FileHolder::FileHolder(const path &fn)
-    : f(fn, "ab"), fn(fn)
+    : lock(lockFile(getLockFileName(fn))), f(fn, "ab"), fn(fn)
 {
     // goes first
     // but maybe remove?
@@ -296,24 +966,145 @@ detail::FileHolder::FileHolder(const path &fn)
 
 detail::FileHolder::~FileHolder()
 {
+    // log is kept, it is merged into segment later
     f.close();
+}
+
+// producers wait when this much is not written yet
+static const size_t log_max_pending = 64 << 20;
+static const auto log_sync_interval = std::chrono::seconds(1);
+
+detail::LogWriter::LogWriter(const path &fn)
+    : f(fn)
+{
+    t = std::thread([this] { run(); });
+}
 
-    error_code ec; // remove ec? but multiple processes may be writing into this log? or not?
-    fs::remove(fn, ec);
+detail::LogWriter::~LogWriter()
+{
+    {
+        std::unique_lock lk(m);
+        stopped = true;
+    }
+    cv.notify_one();
+    t.join();
+}
+
+void detail::LogWriter::write(const std::vector<uint8_t> &v)
+{
+    std::unique_lock lk(m);
+    cv_space.wait(lk, [this, &v] { return pending.empty() || pending.size() + v.size() <= log_max_pending; });
+    auto notify = pending.empty();
+    pending.insert(pending.end(), v.begin(), v.end());
+    lk.unlock();
+    if (notify)
+        cv.notify_one();
+}
+
+void detail::LogWriter::run()
+{
+    std::vector<uint8_t> buf;
+    auto last_sync = std::chrono::steady_clock::now();
+    bool dirty = false;
+    bool error = false;
+    while (1)
+    {
+        bool stop;
+        {
+            std::unique_lock lk(m);
+            cv.wait_for(lk, log_sync_interval, [this] { return stopped || !pending.empty(); });
+            // everything that came during previous write goes in one batch
+            buf.swap(pending);
+            stop = stopped;
+        }
+        cv_space.notify_all();
+
+        if (!buf.empty())
+        {
+            auto h = f.f.getHandle();
+            if ((fwrite(buf.data(), buf.size(), 1, h) != 1 || fflush(h) != 0) && !error)
+            {
+                error = true;
+                LOG_ERROR(logger, "Cannot write command log: " << normalize_path(f.fn));
+            }
+            buf.clear();
+            dirty = true;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (dirty && (stop || now - last_sync >= log_sync_interval))
+        {
+            syncFile(f.f.getHandle());
+            dirty = false;
+            last_sync = now;
+        }
+
+        if (stop)
+        {
+            std::unique_lock lk(m);
+            if (pending.empty())
+                break;
+        }
+    }
 }
 
 CommandStorage::CommandStorage(const SwBuilderContext &swctx)
     : swctx(swctx), fdb(swctx)
 {
     load();
+
+#ifndef _WIN32
+    // merge logs of previous runs in background, mapped segment stays valid after replace
+    std::vector<path> dirs;
+    for (bool l : { true, false })
+    {
+        auto d = fs::absolute(fdb.getDir(l));
+        if (fdb.needsCompaction(d))
+            dirs.push_back(d);
+    }
+    if (!dirs.empty())
+    {
+        compactor = std::thread([this, dirs]
+        {
+            for (auto &d : dirs)
+            {
+                try
+                {
+                    fdb.compact(d, stop_compaction);
+                }
+                catch (std::exception &e)
+                {
+                    LOG_WARN(logger, "Command db compaction failed: " << e.what());
+                }
+            }
+        });
+    }
+#endif
 }
 
 CommandStorage::~CommandStorage()
 {
+    // unfinished compaction is continued by the next run
+    stop_compaction = true;
+    if (compactor.joinable())
+        compactor.join();
+
     try
     {
         closeLogs();
-        save();
+
+#ifdef _WIN32
+        // mapped segment cannot be replaced, so compact only after unmapping
+        local.db.reset();
+        global.db.reset();
+        stop_compaction = false;
+        for (bool l : { true, false })
+        {
+            auto d = fdb.getDir(l);
+            if (fdb.needsCompaction(d))
+                fdb.compact(d, stop_compaction);
+        }
+#endif
     }
     catch (std::exception &e)
     {
@@ -323,44 +1114,61 @@ CommandStorage::~CommandStorage()
 
 void CommandStorage::async_command_log(const CommandRecord &r, bool local)
 {
-    static std::vector<uint8_t> v;
+    // serialize here, record may be changed later
+    thread_local std::vector<uint8_t> v;
+    thread_local std::vector<uint8_t> buf;
+    FileDb::write(v, r);
+    if (v.empty())
+        return;
 
-    swctx.getFileStorageExecutor().push([this, local, &r]
-    {
-        auto &s = getInternalStorage(local);
+    auto &s = getInternalStorage(local);
+    buf.clear();
 
+    // files go first, then set, so command never refers to missing data
+    // set in segment has all its files in segment too
+    std::unique_lock lk(s.m_log);
+    auto id = r.implicit_inputs_set;
+    if (id && s.logged_sets.insert(id).second && !(s.db && s.db->hasSet(id)))
+    {
+        auto &files = s.getSet(id);
+        for (auto h : files)
         {
-            // write record to vector v
-            fdb.write(v, r, s);
-
-            auto &l = s.getCommandLog(swctx, local);
-            auto sz = v.size();
-            fwrite(&sz, sizeof(sz), 1, l.f.getHandle());
-            fwrite(&v[0], sz, 1, l.f.getHandle());
-            fflush(l.f.getHandle());
+            if (!s.logged_files.insert(h).second || (s.db && s.db->hasFile(h)))
+                continue;
+            auto &f = getPathInterner().getString(s.getFile(h));
+            appendLogRecord(buf, LogRecordType::File, f.data(), f.size());
         }
+        thread_local std::vector<uint8_t> set;
+        set.clear();
+        write_int(set, id);
+        set.insert(set.end(), (const uint8_t *)files.data(), (const uint8_t *)(files.data() + files.size()));
+        appendLogRecord(buf, LogRecordType::FileSet, set.data(), set.size());
+    }
+    appendLogRecord(buf, LogRecordType::Command, v.data(), v.size());
+    s.getCommandLog(swctx, local).write(buf);
+}
 
-        {
-            auto &l = s.getFileLog(swctx, local);
-            for (auto &f : r.getImplicitInputs(s))
-            {
-                auto r = s.file_storage.insert(f);
-                if (!r.second)
-                    continue;
-                auto s = normalize_path(f);
-                auto sz = s.size() + 1;
-                fwrite(&sz, sizeof(sz), 1, l.f.getHandle());
-                fwrite(&s[0], sz, 1, l.f.getHandle());
-                fflush(l.f.getHandle());
-            }
-        }
-    });
+void CommandStorage::async_file_hash_log(const FileHashRecord &r, bool local)
+{
+    auto &s = getInternalStorage(local);
+    {
+        boost::unique_lock lk(s.m_file_hashes);
+        s.file_hashes[r.file] = r;
+    }
+
+    thread_local std::vector<uint8_t> v;
+    thread_local std::vector<uint8_t> buf;
+    FileDb::write(v, r);
+    buf.clear();
+    appendLogRecord(buf, LogRecordType::FileHash, v.data(), v.size());
+    std::unique_lock lk(s.m_log);
+    s.getCommandLog(swctx, local).write(buf);
 }
 
 void detail::Storage::closeLogs()
 {
-    commands.reset();
-    files.reset();
+    std::unique_lock lk(m_log);
+    log.reset();
 }
 
 void CommandStorage::closeLogs()
@@ -369,30 +1177,22 @@ void CommandStorage::closeLogs()
     local.closeLogs();
 }
 
-detail::FileHolder &detail::Storage::getCommandLog(const SwBuilderContext &swctx, bool local)
-{
-    if (!commands)
-        commands = std::make_unique<FileHolder>(getCommandsLogFileName(swctx, local));
-    return *commands;
-}
-
-detail::FileHolder &detail::Storage::getFileLog(const SwBuilderContext &swctx, bool local)
+// under m_log
+detail::LogWriter &detail::Storage::getCommandLog(const SwBuilderContext &swctx, bool local)
 {
-    if (!files)
-        files = std::make_unique<FileHolder>(getCommandsLogFileName(swctx, local) += getFilesSuffix());
-    return *files;
+    if (!log)
+    {
+        auto fn = getCommandsLogFileName(swctx, local);
+        fs::create_directories(fn.parent_path());
+        log = std::make_unique<LogWriter>(fn);
+    }
+    return *log;
 }
 
 void CommandStorage::load()
 {
-    fdb.load(local.file_storage, local.file_storage_by_hash, local.storage, true);
-    fdb.load(global.file_storage, global.file_storage_by_hash, global.storage, false);
-}
-
-void CommandStorage::save()
-{
-    fdb.save(local.file_storage, local, local.storage, true);
-    fdb.save(global.file_storage, global, global.storage, false);
+    fdb.load(local, true);
+    fdb.load(global, false);
 }
 
 ConcurrentCommandStorage &CommandStorage::getStorage(bool local)
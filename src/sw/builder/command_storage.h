@@ -7,22 +7,33 @@
 #pragma once
 
 #include "concurrent_map.h"
+#include "stable_hash.h"
 
 #include <sw/builder/command.h>
 
 #include <boost/thread/shared_mutex.hpp>
 #include <primitives/templates.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace sw
 {
 
 namespace detail
 {
 
+struct Segment;
 struct Storage;
 
+struct FileLock;
+
+// exclusive lock is held while the log is written, so compaction skips live logs
 struct FileHolder
 {
+    std::unique_ptr<FileLock> lock;
     ScopedFile f;
     path fn;
 
@@ -30,17 +41,56 @@ struct FileHolder
     ~FileHolder();
 };
 
+/// Group commit: records of many commands are coalesced into large writes.
+/// Writes are flushed after every batch and synced to disk periodically.
+/// Producers block when the writer falls behind.
+struct SW_BUILDER_API LogWriter
+{
+    LogWriter(const path &fn);
+    ~LogWriter();
+
+    void write(const std::vector<uint8_t> &);
+
+private:
+    FileHolder f;
+    std::mutex m;
+    std::condition_variable cv;
+    std::condition_variable cv_space;
+    std::vector<uint8_t> pending;
+    bool stopped = false;
+    std::thread t;
+
+    void run();
+};
+
 }
 
 struct CommandRecord
 {
-    size_t hash = 0;
+    Hash128 hash;
     fs::file_time_type mtime = fs::file_time_type::min();
-    //Files implicit_inputs;
-    std::unordered_set<size_t> implicit_inputs;
+    // wall clock time of the last execution
+    std::chrono::milliseconds duration{ 0 };
+    // peak rss of the last execution, bytes
+    uint64_t peak_memory = 0;
+    // of all inputs and implicit inputs, used in content hash mode, zero if unknown
+    uint64_t content_hash = 0;
+    // id of deduplicated implicit inputs set, zero if there are none
+    // many commands share the same set of headers
+    size_t implicit_inputs_set = 0;
+
+    PathSet getImplicitInputs(detail::Storage &) const;
+    void setImplicitInputs(const PathSet &, detail::Storage &);
+};
 
-    Files getImplicitInputs(detail::Storage &) const;
-    void setImplicitInputs(const Files &, detail::Storage &);
+/// Content hash of a file as it was at given mtime and size.
+/// Used in content hash mode, so unchanged files are not reread by new processes.
+struct FileHashRecord
+{
+    Hash128 file; // hash of normalized path
+    int64_t mtime = 0;
+    uint64_t size = 0;
+    uint64_t hash = 0;
 };
 
 using ConcurrentCommandStorage = ConcurrentMap<size_t, CommandRecord>;
@@ -49,33 +99,75 @@ struct SwBuilderContext;
 namespace detail
 {
 
-struct Storage
+/// Records live in compacted immutable segment (mmap'd, sorted by hash)
+/// and in append only logs written since last compaction.
+/// Logs are loaded into memory, segment records are copied on first access.
+/// In-memory map is keyed by 64 bits of command hash, full hash is checked on lookup.
+struct SW_BUILDER_API Storage
 {
     ConcurrentCommandStorage storage;
-    std::unique_ptr<FileHolder> commands;
-
-    Files file_storage;
+    std::unique_ptr<Segment> db;
+
+    // guards log and files written to it
+    std::mutex m_log;
+    std::unique_ptr<LogWriter> log;
+    // hashes of files and sets already written to logs
+    std::unordered_set<Hash128> logged_files;
+    std::unordered_set<size_t> logged_sets;
     mutable boost::upgrade_mutex m_file_storage_by_hash;
-    std::unordered_map<size_t, path> file_storage_by_hash;
-    std::unique_ptr<FileHolder> files;
+    std::unordered_map<Hash128, PathId> file_storage_by_hash;
+    // set id -> sorted file hashes
+    mutable boost::upgrade_mutex m_sets;
+    std::unordered_map<size_t, std::vector<Hash128>> sets;
+    // file hash -> content hash record
+    mutable boost::upgrade_mutex m_file_hashes;
+    std::unordered_map<Hash128, FileHashRecord> file_hashes;
+
+    Storage();
+    ~Storage();
+
+    /// nullptr when there is no such record
+    CommandRecord *find(const Hash128 &h);
+    ConcurrentCommandStorage::insert_type insert(const Hash128 &h);
+
+    bool hasFile(const Hash128 &h) const;
+    /// throws when there is no such file
+    PathId getFile(const Hash128 &h) const;
+
+    /// returns set id, zero for empty set
+    /// on id collision next free id is taken
+    size_t addSet(std::vector<Hash128> files);
+    bool hasSet(size_t id) const;
+    /// throws when there is no such set
+    const std::vector<Hash128> &getSet(size_t id);
+
+    /// false when there is no record for this file
+    bool findFileHash(const Hash128 &file, FileHashRecord &r) const;
 
     void closeLogs();
-    FileHolder &getCommandLog(const SwBuilderContext &swctx, bool local);
-    FileHolder &getFileLog(const SwBuilderContext &swctx, bool local);
+    LogWriter &getCommandLog(const SwBuilderContext &swctx, bool local);
 };
 
 }
 
-struct FileDb
+struct SW_BUILDER_API FileDb
 {
     const SwBuilderContext &swctx;
 
     FileDb(const SwBuilderContext &swctx);
 
-    void load(Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands, bool local) const;
-    void save(const Files &files, const detail::Storage &, ConcurrentCommandStorage &commands, bool local) const;
+    path getDir(bool local) const;
+    void load(detail::Storage &, bool local) const;
+
+    static void load(detail::Storage &, const path &dir);
+    static bool needsCompaction(const path &dir);
+    /// merge closed logs into the segment, returns false when there is nothing to do
+    static bool compact(const path &dir, const std::atomic_bool &stop);
 
-    static void write(std::vector<uint8_t> &, const CommandRecord &, const detail::Storage &);
+    static void write(std::vector<uint8_t> &, const CommandRecord &);
+    static void write(std::vector<uint8_t> &, const FileHashRecord &);
+    /// appends checksummed command record in log format
+    static void writeLogRecord(std::vector<uint8_t> &, const CommandRecord &);
 };
 
 struct SW_BUILDER_API CommandStorage
@@ -88,16 +180,18 @@ struct SW_BUILDER_API CommandStorage
     ~CommandStorage();
 
     void load();
-    void save();
 
     ConcurrentCommandStorage &getStorage(bool local);
     detail::Storage &getInternalStorage(bool local);
     void async_command_log(const CommandRecord &r, bool local);
+    void async_file_hash_log(const FileHashRecord &r, bool local);
 
 private:
     FileDb fdb;
     detail::Storage global;
     detail::Storage local;
+    std::thread compactor;
+    std::atomic_bool stop_compaction = false;
 
     void closeLogs();
 };
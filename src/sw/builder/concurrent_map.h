@@ -6,43 +6,40 @@
 
 #pragma once
 
-#include <junction/ConcurrentMap_Leapfrog.h>
-#include <primitives/exceptions.h>
-#include <primitives/templates.h>
-
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace sw
 {
 
-using ConcurrentContext = junction::QSBR::Context;
-
+/// Hash map for concurrent inserts and lookups.
+///
+/// Keys are spread over lock-striped shards.
+/// Values are owned by the map and allocated separately,
+/// so pointers to them are valid until the map is cleared or destroyed.
+/// Values are never removed one by one.
 template <class K, class V>
 struct ConcurrentMap
 {
-    using MapType = junction::ConcurrentMap_Leapfrog<K, V*>;
-    //using MapType = std::unordered_map<K, V*>;
     using value_type = std::pair<K, V>;
     using insert_type = std::pair<V*, bool>;
 
     ConcurrentMap()
+        : shards(new Shard[n_shards])
     {
-        clear();
     }
 
-    ~ConcurrentMap()
-    {
-        // causes crashes
-        /*if (!map)
-            return;
-        for (auto i = getIterator(); i.isValid(); i.next())
-            delete i.getValue();
-        map.reset();*/
-    }
+    ConcurrentMap(const ConcurrentMap &) = delete;
+    ConcurrentMap &operator=(const ConcurrentMap &) = delete;
 
+    /// not thread safe
     void clear()
     {
-        map = std::make_unique<MapType>();
+        for (size_t i = 0; i < n_shards; i++)
+            shards[i].map.clear();
     }
 
     insert_type insert(const value_type &v)
@@ -50,65 +47,19 @@ struct ConcurrentMap
         return insert(v.first, v.second);
     }
 
-    template <class Deleter>
-    insert_type insert(K k, const V &v, Deleter &&d)
-    {
-        if (k == 0)
-            throw SW_RUNTIME_ERROR("ConcurrentMap: zero key");
-
-        //std::unique_lock lk(m);
-        return insert_no_lock(k, v, d);
-    }
-
-    template <class Deleter>
-    insert_type insert_no_lock(K k, const V &v, Deleter &&d)
-    {
-        if (k == 0)
-            throw SW_RUNTIME_ERROR("ConcurrentMap: zero key");
-
-        /*auto i = map->find(k);
-        if (i == map->end())
-        {
-            auto value = new V(v);
-            map->emplace(k, value);
-            return { value, true };
-        }
-        return { i->second, false };*/
-
-        auto i = map->insertOrFind(k);
-        auto value = i.getValue();
-        if (!value)
-        {
-            value = new V(v);
-            auto oldValue = i.exchangeValue(value);
-            if (oldValue)
-            {
-                *value = *oldValue;
-                std::forward<Deleter>(d)(oldValue);
-                return { value, false };
-            }
-            return { value, true };
-        }
-        return { value, false };
-    }
-
     insert_type insert(K k, const V &v = V())
     {
-        if constexpr (std::is_pointer_v<V>)
-            return insert(k, v, [](auto *v)
+        auto &s = getShard(k);
         {
-            junction::DefaultQSBR.enqueue(&V::destroy, v);
-        });
-        else
-            return insert(k, v, [](auto *v) {});
-    }
-
-    insert_type insert_ptr(K k, const V &v = V())
-    {
-        if constexpr (std::is_pointer_v<V>)
-            return insert(k, v, [](auto *v) { delete *v; });
-        else
-            return insert(k, v, [](auto *v) {});
+            std::shared_lock lk(s.m);
+            if (auto i = s.map.find(k); i != s.map.end())
+                return { i->second.get(), false };
+        }
+        std::unique_lock lk(s.m);
+        auto i = s.map.try_emplace(k);
+        if (i.second)
+            i.first->second = std::make_unique<V>(v);
+        return { i.first->second.get(), i.second };
     }
 
     V &operator[](K k)
@@ -116,48 +67,74 @@ struct ConcurrentMap
         return *insert(k).first;
     }
 
-    const V &operator[](K k) const
+    /// returns nullptr when value is missing, does not insert
+    V *find(K k) const
     {
-        return *insert(k).first;
+        auto &s = getShard(k);
+        std::shared_lock lk(s.m);
+        if (auto i = s.map.find(k); i != s.map.end())
+            return i->second.get();
+        return nullptr;
     }
 
-    auto getIterator()
+    size_t size() const
     {
-        return typename MapType::Iterator(*map);
+        size_t n = 0;
+        for (size_t i = 0; i < n_shards; i++)
+        {
+            std::shared_lock lk(shards[i].m);
+            n += shards[i].map.size();
+        }
+        return n;
     }
 
+    /// Iterates over a snapshot taken shard by shard,
+    /// so other threads may insert meanwhile (e.g. during save).
+    /// Values inserted after the snapshot of their shard are not visited.
     struct end_iterator {};
     struct iterator
     {
-        typename MapType::Iterator i;
-
-        iterator(typename MapType::Iterator i) : i(i) {}
+        std::shared_ptr<std::vector<std::pair<K, V*>>> items;
+        size_t i = 0;
 
-        bool operator!=(const end_iterator &e) const { return i.isValid(); }
-        std::pair<K, V&> operator*() { return { i.getKey(), *i.getValue() }; }
-        void operator++() { i.next(); }
+        bool operator!=(const end_iterator &) const { return i < items->size(); }
+        std::pair<K, V&> operator*() const { return { (*items)[i].first, *(*items)[i].second }; }
+        void operator++() { ++i; }
     };
 
-    iterator begin() { return getIterator(); }
-    end_iterator end() { return {}; }
+    iterator begin() const
+    {
+        iterator it;
+        it.items = std::make_shared<std::vector<std::pair<K, V*>>>();
+        for (size_t i = 0; i < n_shards; i++)
+        {
+            std::shared_lock lk(shards[i].m);
+            for (auto &[k, v] : shards[i].map)
+                it.items->emplace_back(k, v.get());
+        }
+        return it;
+    }
+    end_iterator end() const { return {}; }
 
-    // for usual maps
-    //iterator begin() { return map->begin(); }
-    //iterator end() { return map->end(); }
+private:
+    static constexpr int shard_bits = 6;
+    static constexpr size_t n_shards = 1 << shard_bits;
 
-    //auto begin() const { return map->begin(); }
-    //auto end() const { return map->end(); }
+    // on separate cache lines, so threads working with different shards do not interfere
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex m;
+        std::unordered_map<K, std::unique_ptr<V>> map;
+    };
 
+    std::unique_ptr<Shard[]> shards;
 
-    /*for (auto i = getIterator(); i.isValid(); i.next())
+    Shard &getShard(const K &k) const
     {
-        b.write(i.getKey());
-        b.write(*i.getValue()->mtime);
-    }*/
-
-private:
-    std::unique_ptr<MapType> map;
-    //std::mutex m;
+        // keys are often hashes or sequential ids, mix them before taking high bits
+        uint64_t h = std::hash<K>()(k) * 0x9E3779B97F4A7C15ULL;
+        return shards[h >> (64 - shard_bits)];
+    }
 };
 
 template <class V>
@@ -188,22 +165,10 @@ struct ConcurrentHashMap : ConcurrentMapSimple<V>
         return *insert(k).first;
     }
 
-    const V &operator[](const K &k) const
+    V *find(const K &k) const
     {
-        return *insert(k).first;
+        return Base::find(std::hash<K>()(k));
     }
 };
 
-SW_BUILDER_API
-SW_DECLARE_GLOBAL_STATIC_FUNCTION(ConcurrentContext, getConcurrentContext);
-
-SW_BUILDER_API
-ConcurrentContext createConcurrentContext();
-
-SW_BUILDER_API
-void destroyConcurrentContext(ConcurrentContext ctx);
-
-SW_BUILDER_API
-void updateConcurrentContext();
-
 }
@@ -0,0 +1,115 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "depfile.h"
+
+#include <string>
+
+// deps file is a make in form
+// target: dependencies
+// deps are split by spaces on several lines with \ at the end of each line except the last one
+//
+// example:
+//
+// file.o: dep1.cpp dep2.cpp \
+//  dep1.h dep2.h \
+//  dep3.h \
+//  dep4.h
+//
+// dep1.h:
+//
+
+namespace sw
+{
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+void parseDepfile(std::string_view s, const std::function<void(std::string_view)> &f)
+{
+    const auto n = s.size();
+    // we are after ':' of the current rule
+    bool prerequisites = false;
+    // used only for paths with escapes
+    std::string buf;
+
+    size_t i = 0;
+    while (i < n)
+    {
+        auto c = s[i];
+        if (c == '\n')
+        {
+            // end of rule
+            prerequisites = false;
+            i++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r')
+        {
+            i++;
+            continue;
+        }
+        if (c == '\\' && i + 1 < n && (s[i + 1] == '\n' || s[i + 1] == '\r'))
+        {
+            // line continuation, CR LF case or just LF or CR
+            i += 2;
+            if (s[i - 1] == '\r' && i < n && s[i] == '\n')
+                i++;
+            continue;
+        }
+
+        const auto start = i;
+        bool escaped = false;
+        bool colon = false;
+        for (; i < n; i++)
+        {
+            c = s[i];
+            if (is_space(c))
+                break;
+            // use exactly ': ' because on windows target is 'C:/path/to/file: '
+            if (c == ':' && (i + 1 == n || is_space(s[i + 1])))
+            {
+                colon = true;
+                break;
+            }
+            char unescaped = 0;
+            if (c == '\\' && i + 1 < n)
+            {
+                auto c2 = s[i + 1];
+                if (c2 == '\n' || c2 == '\r')
+                    break;
+                if (c2 == ' ' || c2 == '#')
+                    unescaped = c2;
+            }
+            else if (c == '$' && i + 1 < n && s[i + 1] == '$')
+                unescaped = '$';
+            if (unescaped)
+            {
+                if (!escaped)
+                {
+                    buf.assign(s.data() + start, i - start);
+                    escaped = true;
+                }
+                buf += unescaped;
+                i++;
+            }
+            else if (escaped)
+                buf += c;
+        }
+
+        if (prerequisites && i > start)
+            f(escaped ? std::string_view(buf) : s.substr(start, i - start));
+        if (colon)
+        {
+            prerequisites = true;
+            i++;
+        }
+    }
+}
+
+}
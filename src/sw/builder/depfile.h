@@ -0,0 +1,25 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <functional>
+#include <string_view>
+
+namespace sw
+{
+
+/// Single pass parser of make depfiles produced by gcc/clang (-MD).
+///
+/// Calls f for every prerequisite, targets are skipped.
+/// Handles several rules (-MP), line continuations, CRLF,
+/// escaped spaces and '#', '$$'.
+/// Passed string is valid only during the call,
+/// it points into contents unless the path had escapes.
+SW_BUILDER_API
+void parseDepfile(std::string_view contents, const std::function<void(std::string_view)> &f);
+
+}
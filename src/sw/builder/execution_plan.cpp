@@ -6,30 +6,68 @@
 
 #include "execution_plan.h"
 
+#include "command_storage.h"
+#include "file.h"
+#include "jobserver.h"
+#include "sw_context.h"
+
 #include <sw/support/exceptions.h>
 
 #include <nlohmann/json.hpp>
 #include <primitives/exceptions.h>
+#include <primitives/templates.h>
+
+#include <deque>
+#include <numeric>
+#include <queue>
+#include <thread>
 
 namespace sw
 {
 
+// work stealing worker of current thread,
+// plans may be executed from commands of other plans, so queues are checked too
+struct CurrentWorker
+{
+    const void *queues = nullptr;
+    size_t index = 0;
+};
+static thread_local CurrentWorker current_worker;
+
+Executor &getSecondaryExecutor()
+{
+    static Executor e("secondary executor", getExecutor().numberOfThreads());
+    return e;
+}
+
 ExecutionPlan::~ExecutionPlan()
 {
-    auto break_commands = [](auto &a)
-    {
-        // FIXME: clear() may destroy our next pointer in 'a' variable,
-        // so we make a copy of everything :(
-        std::vector<std::shared_ptr<T>> copy;
-        copy.reserve(a.size());
-        for (auto &c : a)
-            copy.emplace_back(c->shared_from_this());
-        for (auto &c : a)
-            c->clear();
-    };
-    break_commands(commands);
-    break_commands(unprocessed_commands);
-    break_commands(unprocessed_commands_set);
+    // Plan does not link commands to each other,
+    // so only cyclic dependencies must be broken here.
+    // clear() may destroy other unprocessed commands, keep them alive.
+    std::vector<std::shared_ptr<T>> copy;
+    copy.reserve(unprocessed_commands.size());
+    for (auto &c : unprocessed_commands)
+        copy.emplace_back(c->shared_from_this());
+    for (auto &c : unprocessed_commands)
+        c->clear();
+}
+
+ExecutionPlan::Adjacency ExecutionPlan::Adjacency::permute(const std::vector<Id> &order, const std::vector<Id> &new_ids) const
+{
+    Adjacency a;
+    a.offsets.reserve(order.size() + 1);
+    a.edges.reserve(edges.size());
+    for (auto i : order)
+    {
+        for (auto e : (*this)[i])
+        {
+            if (new_ids[e] != (Id)-1)
+                a.edges.push_back(new_ids[e]);
+        }
+        a.offsets.push_back((Id)a.edges.size());
+    }
+    return a;
 }
 
 void ExecutionPlan::execute(Executor &e) const
@@ -38,13 +76,25 @@ void ExecutionPlan::execute(Executor &e) const
         return;
 
     std::mutex m;
-    std::vector<Future<void>> fs;
-    std::vector<Future<void>> all;
+    std::condition_variable cv;
+    std::vector<std::exception_ptr> eptrs;
     std::atomic_bool stopped = false;
-    std::atomic_int running = 0;
     std::atomic_int64_t askip_errors = skip_errors;
+    std::atomic_size_t executed = 0;
+    // number of pushed, but not yet finished jobs
+    // main thread holds one extra token while it pushes initial jobs
+    std::atomic_size_t jobs = 1;
+    // number of not yet executed dependencies of every command
+    std::unique_ptr<std::atomic<Id>[]> dependencies_left(new std::atomic<Id>[commands.size()]);
+    for (Id i = 0; i < commands.size(); i++)
+        dependencies_left[i] = (Id)dependencies[i].size();
 
     bool build_commands = dynamic_cast<builder::Command *>(*commands.begin());
+    if (build_commands)
+        prefetchFiles(e);
+    auto js = build_commands ? getJobServer(e.numberOfThreads()) : nullptr;
+    MemoryPool memory_pool;
+    memory_pool.limit = memory_limit;
 
     // set numbers
     std::atomic_size_t current_command = 1;
@@ -59,100 +109,216 @@ void ExecutionPlan::execute(Executor &e) const
             static_cast<builder::Command*>(c)->show_output |= show_output;
             static_cast<builder::Command*>(c)->write_output_to_file |= write_output_to_file;
             static_cast<builder::Command*>(c)->always |= build_always;
+            if (js)
+                static_cast<builder::Command*>(c)->jobserver = js;
+            static_cast<builder::Command*>(c)->memory_pool = memory_limit ? &memory_pool : nullptr;
         }
     }
 
-    std::function<void(PtrT)> run;
-    run = [this, &askip_errors, &e, &run, &fs, &all, &m, &stopped, &running](T *c)
+    // used by work stealing workers to wait for new commands
+    std::mutex m_idle;
+    std::condition_variable cv_idle;
+
+    auto job_done = [&jobs, &m, &cv, &m_idle, &cv_idle]()
+    {
+        if (--jobs != 0)
+            return;
+        // take the locks, so waiters won't miss the notification
+        {
+            std::unique_lock<std::mutex> lk(m_idle);
+            cv_idle.notify_all();
+        }
+        std::unique_lock<std::mutex> lk(m);
+        cv.notify_all();
+    };
+
+    std::function<void(Id)> push;
+
+    auto run = [this, &askip_errors, &push, &m, &eptrs, &stopped, &executed, &dependencies_left](Id i)
     {
         if (stopped)
             return;
+
+        auto c = commands[i];
         try
         {
-            running++;
             c->execute();
-            running--;
+            executed++;
         }
         catch (...)
         {
-            running--;
+            executed++;
             if (--askip_errors < 1)
                 stopped = true;
             if (throw_on_errors)
-                throw; // don't go futher on DAG by default
-        }
-        for (auto &d : c->dependent_commands)
-        {
-            if (--d->dependencies_left == 0)
             {
                 std::unique_lock<std::mutex> lk(m);
-                fs.push_back(e.push([&run, d] {run((T *)d.get()); }));
-                all.push_back(fs.back());
+                eptrs.push_back(std::current_exception());
+                return; // don't go futher on DAG by default
             }
         }
 
+        std::vector<Id> ready;
+        for (auto d : dependents[i])
+        {
+            if (--dependencies_left[d] == 0)
+                ready.push_back(d);
+        }
+        // the longest critical path is pushed last, so it is popped first from worker's deque
+        std::sort(ready.begin(), ready.end(), [this](auto c1, auto c2)
+        {
+            return commands[c1]->critical_path < commands[c2]->critical_path;
+        });
+        for (auto &d : ready)
+            push(d);
+
         if (stop_time && Clock::now() > *stop_time)
             stopped = true;
     };
 
-    // we cannot know exact number of commands to be executed,
-    // because some of them might use write_file_if_different idiom,
-    // so actual number is known only at runtime
-    // we can just skip some amount of numbers
+    // ready commands, the longest critical path goes first
+    std::mutex m_ready;
+    auto cmp = [this](Id c1, Id c2) { return commands[c1]->critical_path < commands[c2]->critical_path; };
+    std::priority_queue<Id, std::vector<Id>, decltype(cmp)> ready(cmp);
 
-    // TODO: check non-outdated commands and lower total_commands
-    // total_commands -= non outdated;
+    // per worker ready queues
+    struct WorkerQueue
+    {
+        std::mutex m;
+        std::deque<Id> q;
+    };
+    const size_t n_workers = work_stealing ? std::max<size_t>(e.numberOfThreads(), 1) : 0;
+    std::vector<WorkerQueue> queues(n_workers);
+    std::atomic_size_t queued = 0;
+    std::atomic_size_t sleepers = 0;
+    std::atomic_size_t next_queue = 0;
 
-    // run commands without deps
+    if (!work_stealing)
     {
-        std::unique_lock<std::mutex> lk(m);
-        for (auto &c : commands)
+        push = [&e, &run, &job_done, &jobs, &m_ready, &ready](Id c)
         {
-            if (!c->dependencies.empty())
-                //continue;
-                break;
-            fs.push_back(e.push([&run, c] {run(c); }));
-            all.push_back(fs.back());
-        }
+            jobs++;
+            {
+                std::unique_lock<std::mutex> lk(m_ready);
+                ready.push(c);
+            }
+            // job takes the best command at the moment it starts, not this one
+            e.push([&run, &job_done, &m_ready, &ready]
+            {
+                Id c;
+                {
+                    std::unique_lock<std::mutex> lk(m_ready);
+                    c = ready.top();
+                    ready.pop();
+                }
+                run(c);
+                job_done();
+            });
+        };
+    }
+    else
+    {
+        push = [&jobs, &queues, &queued, &sleepers, &next_queue, &m_idle, &cv_idle](Id c)
+        {
+            jobs++;
+            // workers push to their own queues, main thread spreads initial commands
+            auto i = current_worker.queues == &queues ? current_worker.index : next_queue++ % queues.size();
+            {
+                std::unique_lock<std::mutex> lk(queues[i].m);
+                queues[i].q.push_back(c);
+            }
+            queued++;
+            if (sleepers)
+            {
+                std::unique_lock<std::mutex> lk(m_idle);
+                cv_idle.notify_one();
+            }
+        };
     }
 
-    // wait for all commands until exception
-    int i = 0;
-    auto sz = commands.size();
-    std::vector<std::exception_ptr> eptrs;
-    while (i != sz)
+    // take from the back of own queue, steal from the front of others
+    const Id no_command = -1;
+    auto pop = [&queues, &queued, no_command](size_t self) -> Id
     {
-        std::vector<Future<void>> fs2;
+        for (size_t k = 0; k < queues.size(); k++)
         {
-            std::unique_lock<std::mutex> lk(m);
-            fs2 = fs;
-            fs.clear();
+            auto &wq = queues[(self + k) % queues.size()];
+            std::unique_lock<std::mutex> lk(wq.m);
+            if (wq.q.empty())
+                continue;
+            Id c;
+            if (k == 0)
+            {
+                c = wq.q.back();
+                wq.q.pop_back();
+            }
+            else
+            {
+                c = wq.q.front();
+                wq.q.pop_front();
+            }
+            queued--;
+            return c;
         }
-        for (auto &f : fs2)
+        return no_command;
+    };
+
+    auto worker = [&run, &job_done, &pop, &queues, &jobs, &queued, &sleepers, &m_idle, &cv_idle, no_command](size_t self)
+    {
+        auto saved_worker = current_worker;
+        current_worker = { &queues, self };
+        while (1)
         {
-            i++;
-            f.wait();
+            if (auto c = pop(self); c != no_command)
+            {
+                run(c);
+                job_done();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m_idle);
+            sleepers++;
+            cv_idle.wait(lk, [&jobs, &queued] { return queued != 0 || jobs == 0; });
+            sleepers--;
+            if (jobs == 0)
+                break;
         }
-        if (stopped || fs2.empty())
-            break;
-    }
+        current_worker = saved_worker;
+    };
+
+    // we cannot know exact number of commands to be executed,
+    // because some of them might use write_file_if_different idiom,
+    // so actual number is known only at runtime
+    // we can just skip some amount of numbers
+
+    // TODO: check non-outdated commands and lower total_commands
+    // total_commands -= non outdated;
 
-    // wait other jobs to finish or it will crash
-    while (running)
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // own threads, so commands are free to use global executor
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < n_workers; i++)
+        workers.emplace_back(worker, i);
 
-    // gather exceptions
-    for (auto &f : all)
+    // run commands without deps
+    for (Id i = 0; i < commands.size(); i++)
     {
-        if (f.state->eptr)
-            eptrs.push_back(f.state->eptr);
+        if (dependencies[i].size() == 0)
+            push(i);
+    }
+    job_done();
+
+    // wait for all jobs to finish or it will crash,
+    // after an error queued jobs return immediately
+    {
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [&jobs] { return jobs == 0; });
     }
+    for (auto &t : workers)
+        t.join();
 
-    // ... or it will crash here in throw
     if (!eptrs.empty() && throw_on_errors)
         throw ExceptionVector(eptrs);
 
-    if (i != sz/* && !stopped*/)
+    if (executed != commands.size()/* && !stopped*/)
     {
         if (stop_time && Clock::now() > *stop_time && stopped)
             throw SW_RUNTIME_ERROR("Time limit exceeded");
@@ -160,6 +326,60 @@ void ExecutionPlan::execute(Executor &e) const
     }
 }
 
+void ExecutionPlan::prefetchFiles(Executor &e) const
+{
+    // Refresh all files the up-to-date checks will touch in parallel,
+    // so checks only read memory later.
+    std::unordered_set<path> seen;
+    std::vector<std::pair<const builder::Command *, path>> files;
+    auto add = [&seen, &files](auto c, const auto &in)
+    {
+        for (auto &f : in)
+        {
+            if (!f.empty() && seen.insert(f).second)
+                files.emplace_back(c, f);
+        }
+    };
+    for (auto &c : commands)
+    {
+        auto c1 = dynamic_cast<builder::Command *>(c);
+        if (!c1)
+            continue;
+        add(c1, c1->inputs);
+        add(c1, c1->outputs);
+        try
+        {
+            add(c1, c1->getStoredImplicitInputs());
+        }
+        catch (std::exception &)
+        {
+            // will be reported during execution
+        }
+    }
+
+    auto n = std::max<size_t>(e.numberOfThreads(), 1);
+    auto chunk = files.size() / n + 1;
+    Futures<void> fs;
+    for (size_t i = 0; i < files.size(); i += chunk)
+    {
+        fs.push_back(e.push([&files, i, chunk]
+        {
+            for (auto j = i; j < std::min(i + chunk, files.size()); j++)
+            {
+                try
+                {
+                    File(files[j].second, files[j].first->getContext().getFileStorage()).isChanged();
+                }
+                catch (std::exception &)
+                {
+                    // will be reported during execution
+                }
+            }
+        }));
+    }
+    waitAndGet(fs);
+}
+
 void ExecutionPlan::saveChromeTrace(const path &p) const
 {
     // calculate minimal time
@@ -318,18 +538,41 @@ void ExecutionPlan::setup()
     // but influence on performance on execution stages is not very clear
     //transitiveReduction();
 
-    // set number of deps and dependent commands
-    for (auto &c : commands)
+    // commands are in topological order after init(),
+    // so we see all dependent commands before the command itself
+    for (Id i = (Id)commands.size(); i-- > 0;)
     {
-        c->dependencies_left = c->dependencies.size();
-        for (auto &d : c->dependencies)
-            d->dependent_commands.insert(c->shared_from_this());
+        auto c = commands[i];
+        uint64_t longest = 0;
+        for (auto d : dependents[i])
+            longest = std::max(longest, commands[d]->critical_path);
+        // +1 to prefer longer chains when durations are unknown
+        c->critical_path = c->getExpectedDuration().count() + 1 + longest;
+        c->n_dependent_commands = (uint32_t)dependents[i].size();
     }
 
-    std::sort(commands.begin(), commands.end(), [](const auto &c1, const auto &c2)
+    std::vector<Id> order(commands.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](auto c1, auto c2)
     {
-        return c1->lessDuringExecution(*c2);
+        return commands[c1]->lessDuringExecution(*commands[c2]);
     });
+    reorder(order);
+}
+
+void ExecutionPlan::reorder(const std::vector<Id> &order)
+{
+    std::vector<Id> new_ids(commands.size(), (Id)-1);
+    VecT v;
+    v.reserve(order.size());
+    for (auto i : order)
+    {
+        new_ids[i] = (Id)v.size();
+        v.push_back(commands[i]);
+    }
+    dependencies = dependencies.permute(order, new_ids);
+    dependents = dependents.permute(order, new_ids);
+    commands = std::move(v);
 }
 
 ExecutionPlan::GraphMapping ExecutionPlan::getGraphMapping(const VecT &v)
@@ -386,87 +629,169 @@ std::tuple<ExecutionPlan::Graph, ExecutionPlan::VertexMap> ExecutionPlan::transi
     return { tr, vm };
 }
 
-void ExecutionPlan::prepare(USet &cmds)
+// returns commands which are not in cmds yet
+static std::vector<ExecutionPlan::PtrT> discover(ExecutionPlan::USet &cmds, const std::vector<ExecutionPlan::PtrT> &v)
 {
-    // prepare all commands
-    // extract all deps commands
+    // some commands get its i/o deps in wrong order,
+    // so we explicitly call this once more when all generators are set
+    // do not remove!
+    for (auto &c : v)
+    {
+        if (auto c1 = dynamic_cast<builder::Command *>(c))
+            c1->addInputOutputDeps();
+    }
 
-    // try to lower number of rehashes
-    auto reserve = [](auto &a)
+    // additional deps tracking (programs, inputs, outputs etc.)
+    std::vector<ExecutionPlan::PtrT> next;
+    auto add = [&cmds, &next](const auto &d)
     {
-        a.reserve((a.size() / 10000 + 1) * 20000);
+        if (cmds.insert(d.get()).second)
+            next.push_back(d.get());
     };
-    reserve(cmds);
-
-    while (1)
+    for (auto &c : v)
     {
-        size_t sz = cmds.size();
+        for (auto &d : c->dependencies)
+            add(d);
+        // also take explicit dependent commands
+        for (auto &d : c->dependent_commands)
+            add(d);
+    }
+    return next;
+}
 
-        // initial prepare
-        for (auto &c : cmds)
-            c->prepare();
+void ExecutionPlan::prepare(USet &cmds)
+{
+    // prepare all commands
+    // extract all deps commands
 
-        // some commands get its i/o deps in wrong order,
-        // so we explicitly call this once more
-        // do not remove!
-        for (auto &c : cmds)
-        {
-            if (auto c1 = dynamic_cast<builder::Command*>(c))
-                c1->addInputOutputDeps();
-        }
+    // plans are also created from tasks of the main executor (checks)
+    auto &e = getSecondaryExecutor();
 
-        // separate loop for additional deps tracking (programs, inputs, outputs etc.)
-        auto cmds2 = cmds;
-        reserve(cmds2);
-        for (auto &c : cmds)
+    // cmds is also a set of seen commands,
+    // only newly discovered ones are prepared on the next round
+    std::vector<T *> work(cmds.begin(), cmds.end());
+    while (!work.empty())
+    {
+        // every command is prepared by exactly one task,
+        // but some of them must go serially (pipes, user actions)
+        std::vector<T *> serial;
+        Futures<void> fs;
+        for (auto &c : work)
         {
-            for (auto &d : c->dependencies)
+            auto c1 = dynamic_cast<builder::Command *>(c);
+            if (c1 && c1->isPreparedSerially())
             {
-                cmds2.insert((T *)d.get());
-                for (auto &d2 : d->dependencies)
-                    cmds2.insert((T *)d2.get());
+                serial.push_back(c);
+                continue;
             }
-            // also take explicit dependent commands
-            for (auto &d : c->dependent_commands)
-                cmds2.insert((T *)d.get());
+            fs.push_back(e.push([c] { c->prepare(); }));
         }
-        cmds = std::move(cmds2);
+        waitAndGet(fs);
+        for (auto &c : serial)
+            c->prepare();
 
-        if (cmds.size() == sz)
-            break;
+        auto next = discover(cmds, work);
+        // commands of later rounds may set generators of inputs of earlier ones,
+        // so everything is checked once more when nothing new is found
+        if (next.empty())
+            next = discover(cmds, std::vector<T *>(cmds.begin(), cmds.end()));
+        work = std::move(next);
     }
 }
 
 void ExecutionPlan::init(USet &cmds)
 {
-    // remove self deps
+    if (cmds.size() >= (Id)-1)
+        throw SW_RUNTIME_ERROR("Too many commands: " + std::to_string(cmds.size()));
+
     for (auto &c : cmds)
+    {
+        // remove self deps
         c->dependencies.erase(c->shared_from_this());
 
-    while (!cmds.empty())
+        // explicit dependent commands are ordinary dependencies from now,
+        // so commands do not reference each other in both directions
+        for (auto &d : c->dependent_commands)
+        {
+            if (d.get() != c)
+                d->dependencies.insert(c->shared_from_this());
+        }
+        c->dependent_commands.clear();
+    }
+
+    // build graph, deps outside of the set are considered as satisfied
+    commands.assign(cmds.begin(), cmds.end());
+    const Id n = (Id)commands.size();
     {
-        bool added = false;
-        for (auto it = cmds.begin(); it != cmds.end();)
+        std::unordered_map<PtrT, Id> ids;
+        ids.reserve(n);
+        for (Id i = 0; i < n; i++)
+            ids[commands[i]] = i;
+
+        std::vector<std::pair<Id, Id>> edges; // command, its dependency
+        for (Id i = 0; i < n; i++)
         {
-            if (std::all_of((*it)->dependencies.begin(), (*it)->dependencies.end(),
-                [this, &cmds](auto &d) { return cmds.find((T *)d.get()) == cmds.end(); }))
+            for (auto &d : commands[i]->dependencies)
             {
-                added = true;
-                commands.push_back(*it);
-                it = cmds.erase(it);
+                if (auto j = ids.find((T *)d.get()); j != ids.end())
+                    edges.emplace_back(i, j->second);
             }
-            else
-                it++;
         }
-        if (!added)
+
+        auto make = [n, &edges](bool reverse)
         {
-            // We failed with stupid algorithm, now we must perform smarter.
-            // Shall we?
-            unprocessed_commands.insert(unprocessed_commands.end(), cmds.begin(), cmds.end());
-            unprocessed_commands_set = cmds;
-            return;
+            Adjacency a;
+            a.offsets.assign(n + 1, 0);
+            for (auto &[from, to] : edges)
+                a.offsets[(reverse ? to : from) + 1]++;
+            std::partial_sum(a.offsets.begin(), a.offsets.end(), a.offsets.begin());
+            a.edges.resize(edges.size());
+            auto pos = a.offsets;
+            for (auto &[from, to] : edges)
+                a.edges[pos[reverse ? to : from]++] = reverse ? from : to;
+            return a;
+        };
+        dependencies = make(false);
+        dependents = make(true);
+    }
+
+    // Kahn's algorithm, O(V + E)
+    std::vector<Id> indegree(n);
+    std::vector<Id> order;
+    order.reserve(n);
+    for (Id i = 0; i < n; i++)
+    {
+        indegree[i] = (Id)dependencies[i].size();
+        if (indegree[i] == 0)
+            order.push_back(i);
+    }
+    // order vector is our queue
+    for (size_t q = 0; q < order.size(); q++)
+    {
+        for (auto i : dependents[order[q]])
+        {
+            if (--indegree[i] == 0)
+                order.push_back(i);
         }
     }
+
+    cmds.clear();
+    if (order.size() != n)
+    {
+        // Cycle is detected. Vertices on cycles and everything that depends on them
+        // still have non-zero indegree. Leave them for strong components analysis.
+        for (Id i = 0; i < n; i++)
+        {
+            if (indegree[i] == 0)
+                continue;
+            unprocessed_commands.push_back(commands[i]);
+            cmds.insert(commands[i]);
+        }
+        unprocessed_commands_set = cmds;
+    }
+
+    // topological order, unprocessed commands are dropped
+    reorder(order);
 }
 
 ExecutionPlan ExecutionPlan::create(USet &cmds)
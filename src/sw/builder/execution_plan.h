@@ -23,6 +23,11 @@ namespace sw
 
 struct SwBuilderContext;
 
+/// For work started from tasks of the main executor (checks, module scans, plan preparation).
+/// Main executor threads must not wait for tasks pushed to the same executor.
+SW_BUILDER_API
+Executor &getSecondaryExecutor();
+
 // DAG
 struct SW_BUILDER_API ExecutionPlan
 {
@@ -50,6 +55,10 @@ public:
     bool silent = false;
     bool show_output = false;
     bool write_output_to_file = false;
+    // per worker ready queues with stealing instead of global executor
+    bool work_stealing = false;
+    // sum of expected peak memory of running commands, bytes, 0 = unlimited
+    uint64_t memory_limit = 0;
 
     ExecutionPlan() = default;
     ExecutionPlan(const ExecutionPlan &rhs) = delete;
@@ -100,14 +109,45 @@ private:
     using Vertex = typename boost::graph_traits<Graph>::vertex_descriptor;
     using VertexMap = std::unordered_map<Vertex, Vertex>;
 
+    /// index of command in 'commands'
+    using Id = uint32_t;
+
+    /// Compressed sparse rows: edges of command i are edges[offsets[i]] .. edges[offsets[i + 1]].
+    struct Adjacency
+    {
+        struct Range
+        {
+            const Id *b;
+            const Id *e;
+
+            const Id *begin() const { return b; }
+            const Id *end() const { return e; }
+            size_t size() const { return e - b; }
+        };
+
+        std::vector<Id> offsets{ 0 };
+        std::vector<Id> edges;
+
+        Range operator[](Id i) const { return { edges.data() + offsets[i], edges.data() + offsets[i + 1] }; }
+        /// order[new id] = old id, dropped commands have new id equal to -1
+        Adjacency permute(const std::vector<Id> &order, const std::vector<Id> &new_ids) const;
+    };
+
     VecT commands;
     VecT unprocessed_commands;
     USet unprocessed_commands_set;
 
+    // graph of 'commands', dependencies are only those inside the plan
+    Adjacency dependencies;
+    Adjacency dependents;
+
     //
     std::optional<Clock::time_point> stop_time;
 
     void setup();
+    /// order[new id] = old id, commands not in order are removed
+    void reorder(const std::vector<Id> &order);
+    void prefetchFiles(Executor &e) const;
     static GraphMapping getGraphMapping(const VecT &v);
     static Graph getGraph(const VecT &v, GraphMapping &gm);
     void transitiveReduction();
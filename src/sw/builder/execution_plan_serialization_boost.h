@@ -23,6 +23,25 @@ SERIALIZATION_SPLIT_END
 ////////////////////////////////////////
 
 #define SERIALIZATION_TYPE Files
+SERIALIZATION_BEGIN_SPLIT
+    size_t sz;
+    ar >> sz;
+    while (sz--)
+    {
+        path p;
+        ar >> p;
+        v.insert(p);
+    }
+SERIALIZATION_SPLIT_CONTINUE
+    ar << v.size();
+    for (auto &p : v)
+        ar << p;
+SERIALIZATION_SPLIT_END
+
+////////////////////////////////////////
+
+// same format as Files
+#define SERIALIZATION_TYPE ::sw::PathSet
 SERIALIZATION_BEGIN_SPLIT
     size_t sz;
     ar >> sz;
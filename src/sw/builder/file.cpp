@@ -13,6 +13,11 @@
 
 #include <fstream>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "file");
 
@@ -47,7 +52,9 @@ FileData::FileData(const FileData &rhs)
 FileData &FileData::operator=(const FileData &rhs)
 {
     last_write_time = rhs.last_write_time;
-    //size = rhs.size;
+    size = rhs.size;
+    inode = rhs.inode;
+    content_hash = rhs.content_hash.load();
     //hash = rhs.hash;
     //flags = rhs.flags;
 
@@ -58,7 +65,11 @@ FileData &FileData::operator=(const FileData &rhs)
 
 void FileData::reset()
 {
-    generator.reset();
+    {
+        std::unique_lock lk(m);
+        generator.reset();
+        generator_prepared = false;
+    }
     refreshed = FileData::RefreshType::Unrefreshed;
 }
 
@@ -70,6 +81,12 @@ File::File(const path &p, FileStorage &fs)
     data = &fs.registerFile(file);
 }
 
+File::File(PathId id, FileStorage &fs)
+    : file(getPathInterner().getPath(id))
+{
+    data = &fs.registerFile(id);
+}
+
 path File::getPath() const
 {
     return file;
@@ -85,6 +102,89 @@ const FileData &File::getFileData() const
     return *data;
 }
 
+namespace
+{
+
+struct FileStat
+{
+    fs::file_type type = fs::file_type::not_found;
+    fs::file_time_type last_write_time = fs::file_time_type::min();
+    uint64_t size = 0;
+    uint64_t inode = 0;
+};
+
+}
+
+#ifdef __linux__
+static fs::file_time_type::duration to_duration(const struct statx_timestamp &ts)
+{
+    return std::chrono::duration_cast<fs::file_time_type::duration>(
+        std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+}
+
+// Epoch of fs::file_time_type clock is implementation defined,
+// so we take exact offset from the first file we see.
+static fs::file_time_type to_file_time_type(const path &file, const struct statx_timestamp &ts)
+{
+    static std::mutex m;
+    static std::optional<fs::file_time_type::duration> offset;
+    std::unique_lock lk(m);
+    if (!offset)
+    {
+        auto t = fs::last_write_time(file);
+        struct statx stx;
+        if (statx(AT_FDCWD, file.c_str(), 0, STATX_MTIME, &stx) != 0 ||
+            stx.stx_mtime.tv_sec != ts.tv_sec || stx.stx_mtime.tv_nsec != ts.tv_nsec)
+        {
+            // file was changed in the middle, use slow path this time
+            return t;
+        }
+        offset = t.time_since_epoch() - to_duration(ts);
+    }
+    return fs::file_time_type(to_duration(ts) + *offset);
+}
+#endif
+
+// one syscall on linux
+static FileStat getFileStat(const path &file)
+{
+    FileStat s;
+#ifdef __linux__
+    struct statx stx;
+    if (statx(AT_FDCWD, file.c_str(), 0, STATX_TYPE | STATX_MTIME | STATX_SIZE | STATX_INO, &stx) == 0)
+    {
+        if (!S_ISREG(stx.stx_mode))
+        {
+            s.type = fs::file_type::unknown;
+            return s;
+        }
+        s.type = fs::file_type::regular;
+        s.last_write_time = to_file_time_type(file, stx.stx_mtime);
+        s.size = stx.stx_size;
+        s.inode = stx.stx_ino;
+        return s;
+    }
+    if (errno == ENOENT || errno == ENOTDIR)
+        return s;
+    // let std::filesystem report an error
+#endif
+    s.type = fs::status(file).type();
+    if (s.type != fs::file_type::regular)
+        return s;
+    s.last_write_time = fs::last_write_time(file);
+#ifdef _WIN32
+    s.size = fs::file_size(file);
+#else
+    struct stat st;
+    if (::stat(file.c_str(), &st) == 0)
+    {
+        s.size = st.st_size;
+        s.inode = st.st_ino;
+    }
+#endif
+    return s;
+}
+
 void FileData::refresh(const path &file)
 {
     FileData::RefreshType r = FileData::RefreshType::Unrefreshed;
@@ -92,10 +192,10 @@ void FileData::refresh(const path &file)
         return;
 
     bool changed = false;
-    auto s = fs::status(file);
-    if (s.type() != fs::file_type::regular)
+    auto s = getFileStat(file);
+    if (s.type != fs::file_type::regular)
     {
-        if (s.type() != fs::file_type::not_found)
+        if (s.type != fs::file_type::not_found)
             LOG_TRACE(logger, "checking for non-regular file: " << file);
         // we skip non regular files at the moment
         last_write_time = fs::file_time_type::min();
@@ -103,17 +203,41 @@ void FileData::refresh(const path &file)
     }
     else
     {
-        auto t = fs::last_write_time(file);
-        if (t > last_write_time)
+        if (s.last_write_time > last_write_time)
         {
-            last_write_time = t;
+            last_write_time = s.last_write_time;
             changed = true;
         }
+        if (changed || s.size != size || s.inode != inode)
+        {
+            size = s.size;
+            inode = s.inode;
+            content_hash = 0;
+        }
     }
 
     refreshed = changed ? FileData::RefreshType::Changed : FileData::RefreshType::NotChanged;
 }
 
+uint64_t FileData::getContentHash(const path &file)
+{
+    if (auto h = content_hash.load())
+        return h;
+    if (last_write_time == fs::file_time_type::min())
+        return 0; // missing
+    // races are fine, everyone gets the same value
+    auto h = get_content_hash(read_file(file));
+    content_hash = h;
+    return h;
+}
+
+uint64_t get_content_hash(const String &contents)
+{
+    // not a security boundary, only speed matters
+    auto h = xxh64(contents.data(), contents.size());
+    return h ? h : 1;
+}
+
 bool File::isChanged() const
 {
     while (data->refreshed < FileData::RefreshType::NotChanged)
@@ -137,9 +261,15 @@ std::optional<String> File::isChanged(const fs::file_time_type &in, bool throw_o
     return {};
 }
 
+uint64_t File::getContentHash() const
+{
+    isChanged(); // refresh
+    return data->getContentHash(file);
+}
+
 bool File::isGenerated() const
 {
-    return !!data->generator.lock();
+    return !!getGenerator();
 }
 
 bool File::isGeneratedAtAll() const
@@ -157,8 +287,11 @@ void File::setGenerator(const std::shared_ptr<builder::Command> &g, bool ignore_
     if (!g)
         return;
 
+    std::unique_lock lk(data->m);
     auto gold = data->generator.lock();
-    if (!ignore_errors && gold && (gold != g &&
+    // unprepared generator may be in the middle of its prepare() on other thread,
+    // it will check us when it sets itself
+    if (!ignore_errors && gold && data->generator_prepared && (gold != g &&
         !gold->isExecuted() &&
         !gold->maybe_unused &&
         gold->getHash() != g->getHash()))
@@ -168,7 +301,7 @@ void File::setGenerator(const std::shared_ptr<builder::Command> &g, bool ignore_
         if (gold)
         {
             err += "first generator:\n " + gold->print() + "\n";
-            err += "first generator hash:\n " + std::to_string(gold->getHash());
+            err += "first generator hash:\n " + gold->getHash().toString();
         }
         else
             err += "first generator is empty";
@@ -176,18 +309,20 @@ void File::setGenerator(const std::shared_ptr<builder::Command> &g, bool ignore_
         if (g)
         {
             err += "second generator:\n " + g->print() + "\n";
-            err += "second generator hash:\n " + std::to_string(g->getHash());
+            err += "second generator hash:\n " + g->getHash().toString();
         }
         else
             err += "second generator is empty";
         throw SW_RUNTIME_ERROR(err);
     }
     data->generator = g;
+    data->generator_prepared = !ignore_errors;
     data->generated = true;
 }
 
 std::shared_ptr<builder::Command> File::getGenerator() const
 {
+    std::unique_lock lk(data->m);
     return data->generator.lock();
 }
 
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "node.h"
+#include "path_interner.h"
 
 #include <primitives/filesystem.h>
 
@@ -37,11 +38,18 @@ struct FileData
     };
 
     fs::file_time_type last_write_time = fs::file_time_type::min();
-    //int64_t size = -1;
+    uint64_t size = 0;
+    uint64_t inode = 0;
+    // lazy, zero if unknown
+    // (mtime, size, inode) tuple is a fast path, we rehash only when it changes
+    std::atomic_uint64_t content_hash = 0;
     //String hash;
     //SomeFlags flags;
+    // generator fields are guarded by m, commands are prepared in parallel
     std::weak_ptr<builder::Command> generator;
-    bool generated = false;
+    // generator was set from its prepare(), so its hash is final
+    bool generator_prepared = false;
+    std::atomic_bool generated = false;
 
     // downloaded etc.
     // we cut DAG below commands with all such outputs
@@ -49,7 +57,7 @@ struct FileData
 
     // if file info is updated during this run
     std::atomic<RefreshType> refreshed{ RefreshType::Unrefreshed };
-    //mutable std::mutex m;
+    mutable std::mutex m;
 
     FileData() = default;
     FileData(const FileData &);
@@ -57,6 +65,7 @@ struct FileData
 
     void reset();
     void refresh(const path &file);
+    uint64_t getContentHash(const path &file);
 };
 
 struct SW_BUILDER_API File : virtual ICastable
@@ -65,6 +74,7 @@ struct SW_BUILDER_API File : virtual ICastable
 
     File() = default;
     File(const path &p, FileStorage &s);
+    File(PathId id, FileStorage &s);
     virtual ~File() = default;
 
     path getPath() const;
@@ -76,6 +86,7 @@ struct SW_BUILDER_API File : virtual ICastable
 
     bool isChanged() const;
     std::optional<String> isChanged(const fs::file_time_type &t, bool throw_on_missing);
+    uint64_t getContentHash() const;
 
     bool isGenerated() const;
     bool isGeneratedAtAll() const;
@@ -94,4 +105,8 @@ private:
 
 void explainMessage(const String &subject, bool outdated, const String &reason, const String &name);
 
+/// same as FileData content hash, never zero
+SW_BUILDER_API
+uint64_t get_content_hash(const String &contents);
+
 }
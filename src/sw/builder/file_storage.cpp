@@ -7,6 +7,7 @@
 #include "file_storage.h"
 
 #include "file.h"
+#include "file_watcher.h"
 #include "sw_context.h"
 
 #include <primitives/log.h>
@@ -26,12 +27,22 @@ void FileStorage::reset()
         f.reset();
 }
 
-FileData &FileStorage::registerFile(const path &in_f)
+FileData &FileStorage::registerFile(const path &f)
 {
-    auto p = normalize_path(in_f);
-    auto d = files.insert(p);
+    return registerFile(getPathInterner().intern(f));
+}
+
+FileData &FileStorage::registerFile(PathId id)
+{
+    auto d = files.insert(id);
     if (d.second)
-        d.first->refresh(in_f);
+    {
+        auto &p = getPathInterner().getPath(id);
+        // watch before stat, so we do not miss changes in between
+        if (watcher)
+            watcher->addFile(p);
+        d.first->refresh(p);
+    }
     return *d.first;
 }
 
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "concurrent_map.h"
+#include "path_interner.h"
 
 #include <primitives/filesystem.h>
 
@@ -14,18 +15,23 @@ namespace sw
 {
 
 struct FileData;
+struct FileWatcher;
 struct SwBuilderContext;
 
 struct SW_BUILDER_API FileStorage
 {
-    using FileDataHashMap = ConcurrentHashMap<path, FileData>;
+    // keyed by PathId
+    using FileDataHashMap = ConcurrentMapSimple<FileData>;
 
     FileDataHashMap files;
+    // when set, new files are watched for changes
+    FileWatcher *watcher = nullptr;
 
     void clear(); // remove?
     void reset(); // remove?
 
     FileData &registerFile(const path &f);
+    FileData &registerFile(PathId id);
 };
 
 }
@@ -0,0 +1,213 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "file_watcher.h"
+
+#include "file.h"
+#include "file_storage.h"
+
+#include <sw/support/filesystem.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "file_watcher");
+
+namespace sw
+{
+
+FileWatcher::FileWatcher(FileStorage &fs)
+    : fs(fs)
+{
+#ifdef __linux__
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1)
+        throw SW_RUNTIME_ERROR("Cannot create inotify instance");
+#else
+    SW_UNIMPLEMENTED;
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    close(fd);
+#endif
+}
+
+void FileWatcher::addFile(const path &f)
+{
+    addDirectory(f.parent_path());
+}
+
+void FileWatcher::addDirectory(const path &in)
+{
+#ifdef __linux__
+    if (in.empty())
+        return;
+    path d = normalize_path(in);
+
+    std::unique_lock lk(m);
+    if (!watched.insert(d).second)
+        return;
+    auto wd = inotify_add_watch(fd, d.c_str(),
+        IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+        IN_ONLYDIR | IN_EXCL_UNLINK);
+    if (wd == -1)
+    {
+        if (errno == ENOSPC && !limit_reached)
+        {
+            limit_reached = true;
+            LOG_WARN(logger, "inotify watch limit is reached, some changes will be missed. "
+                "Increase fs.inotify.max_user_watches");
+        }
+        // missing dirs are fine, there is nothing to invalidate
+        return;
+    }
+    dirs[wd] = d;
+#endif
+}
+
+#ifdef __linux__
+bool FileWatcher::isRelevant(const path &p, uint32_t mask)
+{
+    auto id = getPathInterner().find(p);
+    if (auto d = id ? fs.files.find(id) : nullptr)
+    {
+        // our own outputs are reset too, they could be removed between builds,
+        // but they do not trigger a rebuild
+        d->reset();
+        return !d->generated;
+    }
+
+    // unknown file, only new or removed files can change target sources
+    if (!(mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)))
+        return false;
+    // editor backups and swap files
+    auto fn = p.filename().u8string();
+    if (fn.empty() || fn[0] == '.' || fn.back() == '~')
+        return false;
+    // anything under build dirs
+    for (auto &c : p)
+    {
+        if (c == SW_BINARY_DIR)
+            return false;
+    }
+    if (mask & IN_ISDIR)
+        addDirectory(p);
+    return true;
+}
+#endif
+
+Files FileWatcher::wait(std::chrono::milliseconds settle)
+{
+    Files changed;
+#ifdef __linux__
+    bool overflow = false;
+    // block until the first event
+    changed = readEvents(-1, (int)settle.count(), overflow);
+    if (overflow)
+    {
+        LOG_DEBUG(logger, "inotify queue overflow, resetting all files");
+        fs.reset();
+        changed.clear();
+    }
+#else
+    SW_UNIMPLEMENTED;
+#endif
+    return changed;
+}
+
+Files FileWatcher::poll()
+{
+    Files changed;
+#ifdef __linux__
+    bool overflow = false;
+    changed = readEvents(0, 0, overflow);
+    bool incomplete;
+    {
+        std::unique_lock lk(m);
+        incomplete = limit_reached;
+    }
+    if (overflow || incomplete)
+    {
+        LOG_DEBUG(logger, (overflow ? "inotify queue overflow" : "inotify watch limit is reached") << ", resetting all files");
+        fs.reset();
+        changed.clear();
+    }
+#else
+    SW_UNIMPLEMENTED;
+#endif
+    return changed;
+}
+
+#ifdef __linux__
+Files FileWatcher::readEvents(int timeout, int settle, bool &overflow)
+{
+    Files changed;
+    alignas(inotify_event) char buf[64 * 1024];
+    while (1)
+    {
+        pollfd p{ fd, POLLIN, 0 };
+        auto r = ::poll(&p, 1, timeout);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r == -1)
+            throw SW_RUNTIME_ERROR("Cannot poll inotify instance");
+        if (r == 0)
+            break; // settled
+
+        auto n = read(fd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw SW_RUNTIME_ERROR("Cannot read inotify events");
+
+        for (auto b = buf; b < buf + n;)
+        {
+            auto e = (const inotify_event *)b;
+            b += sizeof(inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+
+            path p;
+            {
+                std::unique_lock lk(m);
+                auto i = dirs.find(e->wd);
+                if (i == dirs.end())
+                    continue;
+                if (e->mask & IN_IGNORED)
+                {
+                    // dir was removed, it could be watched again later
+                    watched.erase(i->second);
+                    dirs.erase(i);
+                    continue;
+                }
+                if (!e->len)
+                    continue;
+                p = i->second / e->name;
+            }
+            if (isRelevant(p, e->mask))
+                changed.insert(p);
+        }
+
+        // something interesting came, now wait until it is quiet
+        if (!changed.empty() || overflow)
+            timeout = settle;
+    }
+    return changed;
+}
+#endif
+
+}
@@ -0,0 +1,55 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace sw
+{
+
+struct FileStorage;
+
+/// Watches directories of registered files and resets only touched entries,
+/// so the next build does not stat every file again.
+/// Linux only (inotify).
+struct SW_BUILDER_API FileWatcher
+{
+    FileWatcher(FileStorage &fs);
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+    ~FileWatcher();
+
+    /// watch directory of the file
+    void addFile(const path &f);
+    /// watch directory itself, e.g. source dir where new files may appear
+    void addDirectory(const path &d);
+
+    /// blocks until something relevant is changed, then waits until changes settle
+    /// returns touched files, empty after event queue overflow (all files are reset then)
+    Files wait(std::chrono::milliseconds settle = std::chrono::milliseconds(100));
+    /// takes events came so far without blocking, touched files are reset the same way
+    /// all files are reset after event queue overflow or when some dirs are not watched
+    Files poll();
+
+private:
+    FileStorage &fs;
+    int fd = -1;
+    std::mutex m;
+    std::unordered_map<int, path> dirs; // watch descriptor -> dir
+    std::unordered_set<path> watched;
+    bool limit_reached = false;
+
+    bool isRelevant(const path &p, uint32_t mask);
+    Files readEvents(int timeout, int settle, bool &overflow);
+};
+
+}
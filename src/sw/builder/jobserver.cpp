@@ -0,0 +1,202 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "jobserver.h"
+
+#include <boost/algorithm/string.hpp>
+#include <primitives/exceptions.h>
+#include <primitives/sw/cl.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "jobserver");
+
+static cl::opt<bool> use_jobserver("jobserver", cl::desc("Act as GNU make jobserver for child commands"));
+
+namespace sw
+{
+
+JobServer::~JobServer()
+{
+#ifndef _WIN32
+    // give back what we still hold
+    for (auto c : tokens)
+    {
+        if (write(wfd, &c, 1) != 1)
+            break;
+    }
+    if (rfd != -1)
+        close(rfd);
+    // fifo is opened once for both ends
+    if (wfd != -1 && wfd != rfd)
+        close(wfd);
+    if (isServer())
+        unlink(fifo.c_str());
+#endif
+}
+
+std::unique_ptr<JobServer> JobServer::createClient()
+{
+#ifdef _WIN32
+    // windows jobserver uses named semaphores, not implemented
+    return {};
+#else
+    auto e = getenv("MAKEFLAGS");
+    if (!e)
+        return {};
+
+    // make 4.4: --jobserver-auth=fifo:PATH or --jobserver-auth=R,W
+    // older: --jobserver-auth=R,W or --jobserver-fds=R,W
+    String auth;
+    Strings flags;
+    boost::split(flags, e, boost::is_any_of(" "));
+    for (auto &f : flags)
+    {
+        for (auto prefix : { "--jobserver-auth=", "--jobserver-fds=" })
+        {
+            if (boost::starts_with(f, prefix))
+                auth = f.substr(strlen(prefix)); // last one wins
+        }
+    }
+    if (auth.empty())
+        return {};
+
+    std::unique_ptr<JobServer> js(new JobServer);
+    if (boost::starts_with(auth, "fifo:"))
+    {
+        auto p = auth.substr(5);
+        js->rfd = js->wfd = open(p.c_str(), O_RDWR | O_CLOEXEC);
+        if (js->rfd == -1)
+        {
+            LOG_WARN(logger, "Cannot open jobserver fifo " << p << ", ignoring");
+            return {};
+        }
+        return js;
+    }
+
+    auto pos = auth.find(',');
+    if (pos == auth.npos)
+        return {};
+    js->rfd = std::stoi(auth.substr(0, pos));
+    js->wfd = std::stoi(auth.substr(pos + 1));
+    // make closes fds for recipes that are not marked with '+'
+    if (js->rfd < 0 || js->wfd < 0 || fcntl(js->rfd, F_GETFD) == -1 || fcntl(js->wfd, F_GETFD) == -1)
+    {
+        LOG_WARN(logger, "jobserver is advertised in MAKEFLAGS, but its fds are closed; mark recipe with '+'");
+        return {};
+    }
+    return js;
+#endif
+}
+
+std::unique_ptr<JobServer> JobServer::createServer(int n)
+{
+#ifdef _WIN32
+    return {};
+#else
+    if (n < 1)
+        throw SW_RUNTIME_ERROR("Bad number of jobs: " + std::to_string(n));
+
+    std::unique_ptr<JobServer> js(new JobServer);
+    js->jobs = n;
+    // fifo, because children do not inherit our fds
+    js->fifo = temp_directory_path() / ("sw_jobserver_" + std::to_string(getpid()));
+    unlink(js->fifo.c_str());
+    if (mkfifo(js->fifo.c_str(), 0600) == -1)
+        throw SW_RUNTIME_ERROR("Cannot create jobserver fifo: " + normalize_path(js->fifo));
+    js->rfd = js->wfd = open(js->fifo.c_str(), O_RDWR | O_CLOEXEC);
+    if (js->rfd == -1)
+        throw SW_RUNTIME_ERROR("Cannot open jobserver fifo: " + normalize_path(js->fifo));
+
+    // one token is implicit
+    for (int i = 1; i < n; i++)
+    {
+        char c = '+';
+        if (write(js->wfd, &c, 1) != 1)
+            throw SW_RUNTIME_ERROR("Cannot write jobserver token");
+    }
+    return js;
+#endif
+}
+
+void JobServer::lock()
+{
+    {
+        std::unique_lock lk(m);
+        if (!implicit_token_taken)
+        {
+            implicit_token_taken = true;
+            return;
+        }
+    }
+
+#ifndef _WIN32
+    char c;
+    while (1)
+    {
+        auto r = read(rfd, &c, 1);
+        if (r == 1)
+            break;
+        if (r == -1 && errno == EINTR)
+            continue;
+        throw SW_RUNTIME_ERROR("Cannot read jobserver token");
+    }
+
+    std::unique_lock lk(m);
+    tokens.push_back(c);
+#endif
+}
+
+void JobServer::unlock()
+{
+    std::unique_lock lk(m);
+    if (tokens.empty())
+    {
+        implicit_token_taken = false;
+        return;
+    }
+
+#ifndef _WIN32
+    // tokens must be returned as is
+    auto c = tokens.back();
+    tokens.pop_back();
+    while (write(wfd, &c, 1) == -1 && errno == EINTR)
+        ;
+#endif
+}
+
+String JobServer::getMakeflags() const
+{
+    if (!isServer())
+    {
+        auto e = getenv("MAKEFLAGS");
+        return e ? e : "";
+    }
+    return "-j" + std::to_string(jobs) + " --jobserver-auth=fifo:" + fifo.u8string();
+}
+
+JobServer *getJobServer(int n)
+{
+    static const auto js = [n]() -> std::unique_ptr<JobServer>
+    {
+        if (auto js = JobServer::createClient())
+        {
+            LOG_TRACE(logger, "joined jobserver from MAKEFLAGS");
+            return js;
+        }
+        if (use_jobserver)
+            return JobServer::createServer(n);
+        return {};
+    }();
+    return js.get();
+}
+
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "command.h"
+
+namespace sw
+{
+
+/// GNU make jobserver (posix pipe or fifo tokens)
+/// Every process owns one implicit token, so only additional jobs read tokens.
+struct SW_BUILDER_API JobServer : ResourcePool
+{
+    ~JobServer();
+
+    /// join jobserver advertised in MAKEFLAGS, nullptr if there is no one
+    static std::unique_ptr<JobServer> createClient();
+    /// create fifo jobserver with n tokens (including implicit one)
+    static std::unique_ptr<JobServer> createServer(int n);
+
+    void lock() override;
+    void unlock() override;
+
+    bool isServer() const { return !fifo.empty(); }
+    /// value of MAKEFLAGS for child commands
+    String getMakeflags() const;
+
+private:
+    int rfd = -1;
+    int wfd = -1;
+    path fifo; // server only
+    int jobs = 0; // server only
+    bool implicit_token_taken = false;
+    std::vector<char> tokens;
+
+    JobServer() = default;
+};
+
+/// process wide jobserver, nullptr if disabled
+/// client if MAKEFLAGS advertises jobserver, otherwise server (when enabled by -jobserver)
+SW_BUILDER_API
+JobServer *getJobServer(int n);
+
+}
@@ -0,0 +1,258 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "output_cache.h"
+
+#include <boost/algorithm/string.hpp>
+#include <primitives/exceptions.h>
+#include <primitives/sw/cl.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "output_cache");
+
+static cl::opt<bool> use_output_cache("output-cache", cl::desc("Reuse outputs of commands with the same inputs from the local cache"));
+static cl::opt<int> output_cache_size("output-cache-size", cl::desc("Output cache size limit in MB"), cl::init(5 * 1024));
+
+namespace sw
+{
+
+// reflink, then copy
+// no hard links, outputs are overwritten in place by tools and would damage the entry
+static void restoreFile(const path &from, const path &to)
+{
+    error_code ec;
+    fs::remove(to, ec);
+    fs::create_directories(to.parent_path());
+
+#if defined(__linux__) && defined(FICLONE)
+    {
+        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in != -1)
+        {
+            int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            bool ok = out != -1 && ioctl(out, FICLONE, in) == 0;
+            if (out != -1)
+                close(out);
+            close(in);
+            if (ok)
+            {
+                fs::permissions(to, fs::status(from).permissions());
+                return;
+            }
+            fs::remove(to, ec);
+        }
+    }
+#endif
+
+    fs::copy_file(from, to);
+}
+
+static uint64_t getDirSize(const path &d)
+{
+    uint64_t sz = 0;
+    error_code ec;
+    for (auto &f : fs::recursive_directory_iterator(d, ec))
+    {
+        if (f.is_regular_file(ec))
+            sz += f.file_size(ec);
+    }
+    return sz;
+}
+
+OutputCache::OutputCache(const path &dir, uint64_t max_size)
+    : dir(dir), max_size(max_size)
+{
+    fs::create_directories(dir / "entries");
+    fs::create_directories(dir / "manifests");
+    fs::create_directories(dir / "tmp");
+}
+
+std::unique_ptr<OutputCache> OutputCache::create(const path &dir)
+{
+    if (!use_output_cache)
+        return {};
+    if (output_cache_size <= 0)
+        throw SW_RUNTIME_ERROR("Bad output cache size: " + std::to_string(output_cache_size));
+    return std::make_unique<OutputCache>(dir, output_cache_size * 1024ULL * 1024);
+}
+
+path OutputCache::getEntryDir(const Hash128 &command_hash, uint64_t content_hash) const
+{
+    return dir / "entries" / (command_hash.toString() + "-" + std::to_string(content_hash));
+}
+
+path OutputCache::getManifest(const Hash128 &command_hash) const
+{
+    return dir / "manifests" / command_hash.toString();
+}
+
+std::optional<Files> OutputCache::getImplicitInputs(const Hash128 &command_hash) const
+{
+    auto fn = getManifest(command_hash);
+    if (!fs::exists(fn))
+        return {};
+    Files files;
+    for (auto &l : read_lines(fn))
+    {
+        if (!l.empty())
+            files.insert(l);
+    }
+    return files;
+}
+
+std::optional<OutputCache::Result> OutputCache::restore(const Hash128 &command_hash, uint64_t content_hash, const FilesSorted &outputs)
+{
+    auto d = getEntryDir(command_hash, content_hash);
+    if (!fs::exists(d))
+    {
+        misses++;
+        return {};
+    }
+
+    try
+    {
+        int i = 0;
+        for (auto &o : outputs)
+            restoreFile(d / std::to_string(i++), o);
+
+        Result r;
+        r.out = read_file(d / "out");
+        r.err = read_file(d / "err");
+
+        // mark as recently used
+        fs::last_write_time(d, fs::file_time_type::clock::now());
+        // restored files must look like fresh outputs for dependent commands
+        for (auto &o : outputs)
+            fs::last_write_time(o, fs::file_time_type::clock::now());
+
+        hits++;
+        return r;
+    }
+    catch (std::exception &e)
+    {
+        // evicted or broken entry
+        LOG_DEBUG(logger, "cannot restore " << normalize_path(d) << ": " << e.what());
+        for (auto &o : outputs)
+        {
+            error_code ec;
+            fs::remove(o, ec);
+        }
+        misses++;
+        return {};
+    }
+}
+
+void OutputCache::store(const Hash128 &command_hash, uint64_t content_hash, const FilesSorted &outputs,
+    const PathSet &implicit_inputs, const Result &r)
+{
+    for (auto &o : outputs)
+    {
+        // directories are not supported
+        if (!fs::is_regular_file(o))
+            return;
+    }
+
+    // build entry aside, then move it in place at once
+    auto tmp = dir / "tmp" / unique_path();
+    try
+    {
+        fs::create_directories(tmp);
+        int i = 0;
+        for (auto &o : outputs)
+            fs::copy_file(o, tmp / std::to_string(i++));
+        write_file(tmp / "out", r.out);
+        write_file(tmp / "err", r.err);
+        auto sz = getDirSize(tmp);
+
+        error_code ec;
+        auto d = getEntryDir(command_hash, content_hash);
+        fs::rename(tmp, d, ec);
+        if (ec)
+        {
+            // someone else stored the same entry
+            fs::remove_all(tmp, ec);
+        }
+
+        String s;
+        for (auto &f : FilesSorted(implicit_inputs.begin(), implicit_inputs.end()))
+            s += normalize_path(f) + "\n";
+        auto mtmp = dir / "tmp" / unique_path();
+        write_file(mtmp, s);
+        fs::rename(mtmp, getManifest(command_hash));
+
+        stores++;
+
+        std::unique_lock lk(m);
+        if (!size)
+            size = getDirSize(dir / "entries");
+        else
+            *size += sz;
+        if (*size > max_size)
+            evict();
+    }
+    catch (std::exception &e)
+    {
+        // cache is optional
+        LOG_DEBUG(logger, "cannot store outputs: " << e.what());
+        error_code ec;
+        fs::remove_all(tmp, ec);
+    }
+}
+
+void OutputCache::evict()
+{
+    struct Entry
+    {
+        path p;
+        fs::file_time_type t;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    error_code ec;
+    for (auto &d : fs::directory_iterator(dir / "entries", ec))
+    {
+        Entry e{ d.path(), fs::last_write_time(d.path(), ec), getDirSize(d.path()) };
+        total += e.size;
+        entries.push_back(e);
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto &e1, const auto &e2) { return e1.t < e2.t; });
+
+    // leave some space, so we do not evict on every store
+    auto limit = max_size / 10 * 9;
+    size_t n = 0;
+    for (auto &e : entries)
+    {
+        if (total <= limit)
+            break;
+        fs::remove_all(e.p, ec);
+        total -= e.size;
+        n++;
+    }
+    size = total;
+    LOG_DEBUG(logger, "evicted " << n << " entries, cache size is " << total / 1024 / 1024 << " MB");
+}
+
+String OutputCache::printStats()
+{
+    size_t h = hits.exchange(0);
+    size_t m = misses.exchange(0);
+    size_t s = stores.exchange(0);
+    String r = "Output cache: " + std::to_string(h) + " hits, " + std::to_string(m) + " misses";
+    if (h + m)
+        r += " (" + std::to_string(h * 100 / (h + m)) + "% hit rate)";
+    r += ", " + std::to_string(s) + " stores";
+    return r;
+}
+
+}
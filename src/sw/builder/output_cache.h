@@ -0,0 +1,70 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "path_interner.h"
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+namespace sw
+{
+
+/// Local content addressed cache of command outputs (ccache-like).
+///
+/// Layout of the cache dir:
+///  manifests/<command hash>    - implicit inputs seen during the last run of the command
+///  entries/<command hash>-<content hash>/
+///     0, 1, ...                - outputs in sorted order
+///     out, err                 - captured stdout and stderr
+///
+/// Content hash covers inputs and implicit inputs listed in the manifest,
+/// so a hit is possible before running the command.
+/// Entries are evicted in LRU order (by entry dir time) when cache grows over its size limit.
+struct SW_BUILDER_API OutputCache
+{
+    struct Result
+    {
+        String out;
+        String err;
+    };
+
+    std::atomic_size_t hits = 0;
+    std::atomic_size_t misses = 0;
+    std::atomic_size_t stores = 0;
+
+    OutputCache(const path &dir, uint64_t max_size);
+
+    /// nullptr when disabled by options
+    static std::unique_ptr<OutputCache> create(const path &dir);
+
+    /// implicit inputs of the last successful run
+    std::optional<Files> getImplicitInputs(const Hash128 &command_hash) const;
+
+    /// restores outputs in place, counts hit or miss
+    std::optional<Result> restore(const Hash128 &command_hash, uint64_t content_hash, const FilesSorted &outputs);
+    void store(const Hash128 &command_hash, uint64_t content_hash, const FilesSorted &outputs,
+        const PathSet &implicit_inputs, const Result &r);
+
+    /// prints and resets counters
+    String printStats();
+
+private:
+    path dir;
+    uint64_t max_size;
+    std::mutex m;
+    std::optional<uint64_t> size; // lazily scanned
+
+    path getEntryDir(const Hash128 &command_hash, uint64_t content_hash) const;
+    path getManifest(const Hash128 &command_hash) const;
+    void evict();
+};
+
+}
@@ -0,0 +1,79 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "p1689.h"
+
+#include <primitives/exceptions.h>
+
+#include <nlohmann/json.hpp>
+
+namespace sw
+{
+
+ModuleDeps parseP1689(const String &file, const String &contents)
+{
+    ModuleDeps d;
+    d.file = file;
+    nlohmann::json j;
+    try
+    {
+        j = nlohmann::json::parse(contents);
+    }
+    catch (std::exception &e)
+    {
+        throw SW_RUNTIME_ERROR("Bad module dependencies of " + file + ": " + e.what());
+    }
+    if (!j.contains("rules"))
+        return d;
+    for (auto &r : j["rules"])
+    {
+        if (r.contains("provides"))
+        {
+            for (auto &p : r["provides"])
+                d.provides.push_back(p["logical-name"].get<String>());
+        }
+        if (r.contains("requires"))
+        {
+            for (auto &p : r["requires"])
+            {
+                // header units are not supported
+                if (p.contains("lookup-method"))
+                    continue;
+                d.imports.push_back(p["logical-name"].get<String>());
+            }
+        }
+    }
+    return d;
+}
+
+ModuleGraph getModuleGraph(const std::vector<ModuleDeps> &units)
+{
+    ModuleGraph g;
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        for (auto &m : units[i].provides)
+        {
+            auto [it, inserted] = g.providers.emplace(m, i);
+            if (!inserted && it->second != i)
+                throw SW_RUNTIME_ERROR("module '" + m + "' is provided by two files: " +
+                    units[it->second].file + " and " + units[i].file);
+        }
+    }
+    g.imports.resize(units.size());
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        for (auto &m : units[i].imports)
+        {
+            auto p = g.providers.find(m);
+            if (p == g.providers.end() || p->second == i)
+                continue;
+            g.imports[i].push_back(p->second);
+        }
+    }
+    return g;
+}
+
+}
@@ -0,0 +1,45 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <primitives/string.h>
+
+#include <map>
+#include <vector>
+
+namespace sw
+{
+
+/// Named modules of one translation unit.
+struct ModuleDeps
+{
+    /// source file, for error messages
+    String file;
+    Strings provides;
+    /// header units are not included
+    Strings imports;
+};
+
+/// Parses p1689 (.ddi) output of gcc -fdeps-format=p1689r5 and clang-scan-deps -format=p1689.
+SW_BUILDER_API
+ModuleDeps parseP1689(const String &file, const String &contents);
+
+/// Modules provided and imported inside one set of translation units.
+struct ModuleGraph
+{
+    /// module name -> index of its provider
+    std::map<String, size_t> providers;
+    /// index of unit -> indices of units providing its imports,
+    /// modules of other targets and std ones are left to the compiler
+    std::vector<std::vector<size_t>> imports;
+};
+
+/// Throws when module is provided by two units.
+SW_BUILDER_API
+ModuleGraph getModuleGraph(const std::vector<ModuleDeps> &units);
+
+}
@@ -0,0 +1,123 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "path_interner.h"
+
+#include <primitives/exceptions.h>
+
+#include <unordered_map>
+
+namespace sw
+{
+
+static const size_t n_shards = 64;
+
+struct PathInterner::Shard
+{
+    std::mutex m;
+    std::unordered_map<path::string_type, PathId> ids;
+};
+
+PathInterner::PathInterner()
+    : shards(new Shard[n_shards])
+    , chunks(new std::atomic<Entry *>[max_chunks])
+{
+    for (size_t i = 0; i < max_chunks; i++)
+        chunks[i] = nullptr;
+}
+
+PathInterner::~PathInterner()
+{
+    for (size_t i = 0; i < max_chunks; i++)
+        delete[] chunks[i].load();
+}
+
+PathInterner::Shard &PathInterner::getShard(const path::string_type &s) const
+{
+    return shards[std::hash<path::string_type>()(s) % n_shards];
+}
+
+const PathInterner::Entry &PathInterner::getEntry(PathId id) const
+{
+    if (id == 0 || id > n)
+        throw SW_RUNTIME_ERROR("Bad path id: " + std::to_string(id));
+    return chunks[id >> chunk_bits].load(std::memory_order_acquire)[id & (chunk_size - 1)];
+}
+
+PathId PathInterner::add(const String &normalized, const path::string_type &key)
+{
+    std::unique_lock lk(m_alloc);
+    PathId id = n + 1;
+    auto c = id >> chunk_bits;
+    if (c >= max_chunks)
+        throw SW_RUNTIME_ERROR("Too many paths");
+    auto chunk = chunks[c].load(std::memory_order_relaxed);
+    if (!chunk)
+    {
+        chunk = new Entry[chunk_size];
+        chunks[c].store(chunk, std::memory_order_release);
+    }
+    auto &e = chunk[id & (chunk_size - 1)];
+    e.p = key;
+    e.s = normalized;
+    e.h = Hasher128().update(normalized).digest();
+    // publish after the entry is written
+    n.store(id, std::memory_order_release);
+    return id;
+}
+
+PathId PathInterner::intern(const path &p)
+{
+    // fast path, this spelling is known
+    {
+        auto &s = getShard(p.native());
+        std::unique_lock lk(s.m);
+        if (auto i = s.ids.find(p.native()); i != s.ids.end())
+            return i->second;
+    }
+
+    auto normalized = normalize_path(p);
+    auto key = fs::u8path(normalized).native();
+    PathId id;
+    {
+        auto &s = getShard(key);
+        std::unique_lock lk(s.m);
+        auto &v = s.ids[key];
+        if (!v)
+            v = add(normalized, key);
+        id = v;
+    }
+    if (key != p.native())
+    {
+        auto &s = getShard(p.native());
+        std::unique_lock lk(s.m);
+        s.ids.emplace(p.native(), id);
+    }
+    return id;
+}
+
+PathId PathInterner::find(const path &p) const
+{
+    auto find = [this](const path::string_type &key) -> PathId
+    {
+        auto &s = getShard(key);
+        std::unique_lock lk(s.m);
+        if (auto i = s.ids.find(key); i != s.ids.end())
+            return i->second;
+        return 0;
+    };
+    if (auto id = find(p.native()))
+        return id;
+    return find(fs::u8path(normalize_path(p)).native());
+}
+
+PathInterner &getPathInterner()
+{
+    static PathInterner pi;
+    return pi;
+}
+
+}
@@ -0,0 +1,142 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "stable_hash.h"
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+namespace sw
+{
+
+/// Compact id of interned path, zero is never used.
+using PathId = uint32_t;
+
+/// Process wide storage of paths.
+///
+/// Every distinct path is normalized and hashed once.
+/// Different spellings of the same path (slashes etc.) get the same id.
+/// Entries are never removed, so returned references are valid until exit.
+struct SW_BUILDER_API PathInterner
+{
+    PathInterner();
+    ~PathInterner();
+
+    PathId intern(const path &p);
+    /// zero when path was not interned, does not insert
+    PathId find(const path &p) const;
+
+    /// normalized path
+    const path &getPath(PathId id) const { return getEntry(id).p; }
+    /// normalize_path() of the path
+    const String &getString(PathId id) const { return getEntry(id).s; }
+    /// stable hash of normalized path, used as file id in command db
+    const Hash128 &getHash(PathId id) const { return getEntry(id).h; }
+
+    size_t size() const { return n; }
+
+private:
+    struct Entry
+    {
+        path p;
+        String s;
+        Hash128 h;
+    };
+    struct Shard;
+
+    static constexpr int chunk_bits = 12;
+    static constexpr size_t chunk_size = 1 << chunk_bits;
+    static constexpr size_t max_chunks = 1 << 16;
+
+    // raw and normalized spellings -> id
+    std::unique_ptr<Shard[]> shards;
+    // fixed array of chunks, so readers never lock
+    std::unique_ptr<std::atomic<Entry *>[]> chunks;
+    std::mutex m_alloc;
+    std::atomic<PathId> n = 0;
+
+    const Entry &getEntry(PathId id) const;
+    Shard &getShard(const path::string_type &) const;
+    PathId add(const String &normalized, const path::string_type &key);
+};
+
+SW_BUILDER_API
+PathInterner &getPathInterner();
+
+/// Set of interned paths with the interface of Files.
+/// Iteration gives normalized paths.
+struct SW_BUILDER_API PathSet
+{
+    using Ids = std::unordered_set<PathId>;
+
+    struct const_iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = path;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const path *;
+        using reference = const path &;
+
+        const_iterator() = default;
+        const_iterator(Ids::const_iterator i) : i(i) {}
+
+        reference operator*() const { return getPathInterner().getPath(*i); }
+        pointer operator->() const { return &**this; }
+        const_iterator &operator++() { ++i; return *this; }
+        const_iterator operator++(int) { auto t = *this; ++i; return t; }
+        bool operator==(const const_iterator &rhs) const { return i == rhs.i; }
+        bool operator!=(const const_iterator &rhs) const { return i != rhs.i; }
+
+        PathId id() const { return *i; }
+
+    private:
+        Ids::const_iterator i;
+    };
+    using iterator = const_iterator;
+    using value_type = path;
+
+    PathSet() = default;
+    PathSet(const Files &files) { insert(files.begin(), files.end()); }
+    template <class It>
+    PathSet(It first, It last) { insert(first, last); }
+
+    std::pair<iterator, bool> insert(const path &p) { return insertId(getPathInterner().intern(p)); }
+    std::pair<iterator, bool> insertId(PathId id)
+    {
+        auto r = ids.insert(id);
+        return { iterator(r.first), r.second };
+    }
+    template <class It>
+    void insert(It first, It last)
+    {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+
+    size_t erase(const path &p) { return ids.erase(getPathInterner().find(p)); }
+    iterator find(const path &p) const { return ids.find(getPathInterner().find(p)); }
+    size_t count(const path &p) const { return ids.count(getPathInterner().find(p)); }
+
+    iterator begin() const { return ids.begin(); }
+    iterator end() const { return ids.end(); }
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    void clear() { ids.clear(); }
+
+    const Ids &getIds() const { return ids; }
+
+private:
+    Ids ids;
+};
+
+}
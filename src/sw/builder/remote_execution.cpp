@@ -0,0 +1,667 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "remote_execution.h"
+
+#include "command.h"
+#include "file.h"
+#include "file_storage.h"
+#include "sw_context.h"
+
+#include <boost/algorithm/string.hpp>
+#include <grpcpp/grpcpp.h>
+#include <primitives/exceptions.h>
+#include <primitives/templates.h>
+#include <primitives/sw/cl.h>
+
+#undef ERROR
+#include <sw/protocol/build.grpc.pb.h>
+#undef strtoll
+#undef strtoull
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "remote_execution");
+
+static cl::list<String> remote_workers("remote-workers", cl::desc("Addresses of remote execution workers (host:port)"), cl::CommaSeparated);
+static cl::opt<int> remote_jobs("remote-jobs", cl::desc("Max number of commands running on one remote worker"), cl::init(16));
+static cl::opt<path> remote_token_file("remote-token-file", cl::desc("File with access token of remote workers"));
+static cl::opt<path> remote_tls_ca("remote-tls-ca", cl::desc("Use tls with remote workers, root certificates in pem"));
+
+// messages carry whole files
+static const int max_message_size = -1;
+static const size_t max_upload_size = 16 * 1024 * 1024;
+
+// unavailable worker is retried after this time, doubled on every next failure
+static const auto worker_retry_min = std::chrono::seconds(1);
+static const auto worker_retry_max = std::chrono::seconds(60);
+
+static const String auth_header = "authorization";
+static const String auth_prefix = "Bearer ";
+
+namespace sw
+{
+
+struct RemoteExecutor::Worker
+{
+    using Clock = std::chrono::steady_clock;
+
+    String address;
+    String token;
+    std::unique_ptr<api::build::DistributedBuildService::Stub> stub;
+    std::atomic_int running = 0;
+    // worker is skipped until this time after it was unavailable
+    std::atomic<Clock::rep> retry_time = 0;
+    std::atomic_int failures = 0;
+
+    bool isAvailable() const
+    {
+        return Clock::now().time_since_epoch().count() >= retry_time;
+    }
+
+    void setUnavailable()
+    {
+        auto n = std::min(failures++, 6);
+        auto d = std::min<Clock::duration>(worker_retry_min * (1 << n), worker_retry_max);
+        retry_time = (Clock::now() + d).time_since_epoch().count();
+    }
+
+    void setAvailable()
+    {
+        failures = 0;
+    }
+
+    void setupContext(grpc::ClientContext &context) const
+    {
+        if (!token.empty())
+            context.AddMetadata(auth_header, auth_prefix + token);
+    }
+};
+
+RemoteExecutor::RemoteExecutor(const Strings &addresses, int jobs_per_worker)
+    : jobs_per_worker(jobs_per_worker)
+{
+    if (jobs_per_worker <= 0)
+        throw SW_RUNTIME_ERROR("Bad number of remote jobs: " + std::to_string(jobs_per_worker));
+
+    String token;
+    if (!remote_token_file.empty())
+        token = boost::trim_copy(read_file(remote_token_file));
+    auto creds = grpc::InsecureChannelCredentials();
+    if (!remote_tls_ca.empty())
+    {
+        grpc::SslCredentialsOptions o;
+        o.pem_root_certs = read_file(remote_tls_ca);
+        creds = grpc::SslCredentials(o);
+    }
+
+    for (auto &a : addresses)
+    {
+        grpc::ChannelArguments args;
+        args.SetMaxReceiveMessageSize(max_message_size);
+        args.SetMaxSendMessageSize(max_message_size);
+        auto w = std::make_unique<Worker>();
+        w->address = a;
+        w->token = token;
+        w->stub = api::build::DistributedBuildService::NewStub(grpc::CreateCustomChannel(a, creds, args));
+        workers.push_back(std::move(w));
+    }
+}
+
+RemoteExecutor::~RemoteExecutor()
+{
+}
+
+std::unique_ptr<RemoteExecutor> RemoteExecutor::create()
+{
+    if (remote_workers.empty())
+        return {};
+    return std::make_unique<RemoteExecutor>(Strings(remote_workers.begin(), remote_workers.end()), remote_jobs);
+}
+
+RemoteExecutor::Worker *RemoteExecutor::acquireWorker()
+{
+    // round robin over workers with free slots
+    auto start = next++;
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        auto &w = *workers[(start + i) % workers.size()];
+        if (!w.isAvailable())
+            continue;
+        auto r = w.running.load();
+        while (r < jobs_per_worker)
+        {
+            if (w.running.compare_exchange_weak(r, r + 1))
+                return &w;
+        }
+    }
+    return nullptr;
+}
+
+static bool executeOn(RemoteExecutor::Worker &w, builder::Command &c)
+{
+    if (c.arguments.empty())
+        return false;
+
+    api::build::Command cmd;
+    cmd.set_program(c.getProgram());
+    // first argument is program
+    for (auto a = c.arguments.begin() + 1; a < c.arguments.end(); a++)
+        cmd.add_arguments((*a)->toString());
+    for (auto &[k, v] : c.environment)
+        (*cmd.mutable_environment())[k] = v;
+    cmd.set_working_directory(normalize_path(c.working_directory));
+    cmd.set_prefix_map_option(c.remote_prefix_map_option);
+
+    std::unordered_map<String, path> blobs;
+    FilesSorted files(c.inputs.begin(), c.inputs.end());
+    files.insert(c.implicit_inputs.begin(), c.implicit_inputs.end());
+    for (auto &f : files)
+    {
+        // toolchain must be installed on workers
+        if (f == path(c.getProgram()))
+            continue;
+        auto h = File(f, c.getContext().getFileStorage()).getContentHash();
+        if (!h)
+            return false; // missing
+        auto i = cmd.add_inputs();
+        i->set_path(normalize_path(f));
+        i->set_hash(std::to_string(h));
+        blobs[i->hash()] = f;
+    }
+    for (auto &o : c.outputs)
+        cmd.add_outputs(normalize_path(o));
+    for (auto &d : c.output_dirs)
+        cmd.add_output_dirs(normalize_path(d));
+
+    // upload missing inputs
+    {
+        api::build::BlobHashes request, missing;
+        for (auto &[h, _] : blobs)
+            request.add_hashes(h);
+        grpc::ClientContext context;
+        w.setupContext(context);
+        auto s = w.stub->FindMissingBlobs(&context, request, &missing);
+        if (!s.ok())
+        {
+            if (s.error_code() == grpc::StatusCode::UNAVAILABLE)
+            {
+                LOG_WARN(logger, "Remote worker " << w.address << " is unavailable: " << s.error_message());
+                w.setUnavailable();
+            }
+            else if (s.error_code() == grpc::StatusCode::UNAUTHENTICATED)
+                LOG_WARN(logger, "Remote worker " << w.address << " rejected access token");
+            throw SW_RUNTIME_ERROR("cannot find missing blobs: " + s.error_message());
+        }
+        w.setAvailable();
+
+        api::build::Blobs b;
+        size_t sz = 0;
+        auto flush = [&w, &b, &sz]()
+        {
+            if (!b.blobs_size())
+                return;
+            grpc::ClientContext context;
+            w.setupContext(context);
+            google::protobuf::Empty e;
+            auto s = w.stub->UploadBlobs(&context, b, &e);
+            if (!s.ok())
+                throw SW_RUNTIME_ERROR("cannot upload blobs: " + s.error_message());
+            b.Clear();
+            sz = 0;
+        };
+        for (auto &h : missing.hashes())
+        {
+            auto i = blobs.find(h);
+            if (i == blobs.end())
+                continue;
+            auto bl = b.add_blobs();
+            bl->set_hash(h);
+            bl->set_data(read_file(i->second));
+            sz += bl->data().size();
+            if (sz > max_upload_size)
+                flush();
+        }
+        flush();
+    }
+
+    api::build::CommandResult r;
+    {
+        grpc::ClientContext context;
+        w.setupContext(context);
+        auto s = w.stub->ExecuteCommand(&context, cmd, &r);
+        if (!s.ok())
+            throw SW_RUNTIME_ERROR("cannot execute command: " + s.error_message());
+    }
+    if (r.exit_code())
+        return false;
+
+    // accept only files from our output dirs
+    std::unordered_set<path> dirs(c.output_dirs.begin(), c.output_dirs.end());
+    for (auto &o : c.outputs)
+        dirs.insert(o.parent_path());
+    Files written;
+    for (auto &o : r.outputs())
+    {
+        path p = o.path();
+        if (!c.outputs.count(p) && !dirs.count(p.parent_path()))
+            continue;
+        fs::create_directories(p.parent_path());
+        write_file(p, o.data());
+        written.insert(p);
+    }
+    for (auto &o : c.outputs)
+    {
+        if (!written.count(o))
+            return false;
+    }
+
+    c.out.text = r.out();
+    c.err.text = r.err();
+    return true;
+}
+
+bool RemoteExecutor::execute(builder::Command &c)
+{
+    auto w = acquireWorker();
+    if (!w)
+        return false;
+    SCOPE_EXIT
+    {
+        w->running--;
+    };
+
+    try
+    {
+        if (executeOn(*w, c))
+        {
+            executed++;
+            return true;
+        }
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "remote execution on " << w->address << " failed: " << c.getName() << ": " << e.what());
+    }
+    failed++;
+    return false;
+}
+
+String RemoteExecutor::printStats()
+{
+    size_t e = executed.exchange(0);
+    size_t f = failed.exchange(0);
+    return "Remote execution: " + std::to_string(e) + " commands executed, " + std::to_string(f) + " fell back to local execution";
+}
+
+namespace
+{
+
+struct RemoteWorker final : api::build::DistributedBuildService::Service
+{
+    path dir;
+    // canonical, normalized
+    Strings allowed_programs;
+    String token;
+
+    RemoteWorker(const RemoteWorkerOptions &o)
+        : dir(o.dir), token(o.token)
+    {
+        fs::create_directories(dir / "blobs");
+        fs::create_directories(dir / "actions");
+        fs::create_directories(dir / "scratch");
+        fs::create_directories(dir / "tmp");
+
+        for (auto &p : o.allowed_programs)
+            allowed_programs.push_back(normalize_path(fs::canonical(p)));
+    }
+
+    grpc::Status FindMissingBlobs(grpc::ServerContext *context, const api::build::BlobHashes *request, api::build::BlobHashes *response) override
+    {
+        if (!isAuthorized(*context))
+            return unauthenticated();
+        for (auto &h : request->hashes())
+        {
+            if (!isValidHash(h) || !fs::exists(getBlob(h)))
+                response->add_hashes(h);
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status UploadBlobs(grpc::ServerContext *context, const api::build::Blobs *request, google::protobuf::Empty *) override
+    {
+        if (!isAuthorized(*context))
+            return unauthenticated();
+        for (auto &b : request->blobs())
+        {
+            if (std::to_string(get_content_hash(b.data())) != b.hash())
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "blob hash mismatch: " + b.hash());
+            writeAtomically(getBlob(b.hash()), b.data());
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status ExecuteCommand(grpc::ServerContext *context, const api::build::Command *request, api::build::CommandResult *response) override
+    {
+        if (!isAuthorized(*context))
+            return unauthenticated();
+        try
+        {
+            return execute(*request, *response);
+        }
+        catch (std::exception &e)
+        {
+            return grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+        }
+    }
+
+private:
+    bool isAuthorized(const grpc::ServerContext &context) const
+    {
+        if (token.empty())
+            return true;
+        auto &md = context.client_metadata();
+        auto i = md.find(auth_header);
+        if (i == md.end())
+            return false;
+        String v(i->second.data(), i->second.size());
+        auto expected = auth_prefix + token;
+        if (v.size() != expected.size())
+            return false;
+        // constant time
+        unsigned char d = 0;
+        for (size_t k = 0; k < v.size(); k++)
+            d |= v[k] ^ expected[k];
+        return d == 0;
+    }
+
+    static grpc::Status unauthenticated()
+    {
+        return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "bad access token");
+    }
+
+    bool isAllowedProgram(const String &p) const
+    {
+        error_code ec;
+        auto cp = fs::canonical(p, ec);
+        if (ec)
+            return false;
+        auto s = normalize_path(cp);
+        return std::any_of(allowed_programs.begin(), allowed_programs.end(), [&s](const auto &a)
+        {
+            return s == a || boost::starts_with(s, a + "/");
+        });
+    }
+
+    // variables that make the loader or toolchain run other code
+    static bool isAllowedEnvironmentVariable(const String &k)
+    {
+        for (auto p : { "LD_", "DYLD_", "GCC_EXEC_PREFIX", "COMPILER_PATH", "CCACHE_" })
+        {
+            if (boost::starts_with(k, p))
+                return false;
+        }
+        return true;
+    }
+
+    static bool isValidHash(const String &h)
+    {
+        return !h.empty() && std::all_of(h.begin(), h.end(), [](auto c) { return isdigit(c); });
+    }
+
+    // posix absolute paths without '..'
+    static bool isValidPath(const String &p)
+    {
+        return !p.empty() && p[0] == '/' && p.find("/../") == p.npos && !boost::ends_with(p, "/..");
+    }
+
+    path getBlob(const String &h) const
+    {
+        return dir / "blobs" / h.substr(0, 2) / h;
+    }
+
+    void writeAtomically(const path &p, const String &data) const
+    {
+        auto tmp = dir / "tmp" / unique_path();
+        write_file(tmp, data);
+        fs::create_directories(p.parent_path());
+        fs::rename(tmp, p);
+    }
+
+    static String getActionKey(const api::build::Command &c)
+    {
+        String s;
+        auto add = [&s](const String &v)
+        {
+            s += v;
+            s += '\0';
+        };
+        add(c.program());
+        // same program path may point to other toolchain after upgrade
+        add(std::to_string(fs::file_size(c.program())));
+        add(std::to_string(fs::last_write_time(c.program()).time_since_epoch().count()));
+        for (auto &a : c.arguments())
+            add(a);
+        std::map<String, String> env(c.environment().begin(), c.environment().end());
+        for (auto &[k, v] : env)
+        {
+            add(k);
+            add(v);
+        }
+        add(c.working_directory());
+        add(c.prefix_map_option());
+        for (auto &i : c.inputs())
+        {
+            add(i.path());
+            add(i.hash());
+        }
+        for (auto &o : c.outputs())
+            add(o);
+        for (auto &d : c.output_dirs())
+            add(d);
+        return std::to_string(get_content_hash(s));
+    }
+
+    grpc::Status execute(const api::build::Command &request, api::build::CommandResult &response) const
+    {
+        if (!fs::exists(request.program()))
+            return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "program is not available: " + request.program());
+        if (!isAllowedProgram(request.program()))
+            return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "program is not allowed: " + request.program());
+        for (auto &[k, _] : request.environment())
+        {
+            if (!isAllowedEnvironmentVariable(k))
+                return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "environment variable is not allowed: " + k);
+        }
+        if (!request.in().file().empty() || !request.out().file().empty() || !request.err().file().empty())
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "redirections are not supported");
+
+        // every path we materialize or create and all their parents
+        std::unordered_set<String> known;
+        auto add_known = [&known](String p)
+        {
+            while (!p.empty() && known.insert(p).second)
+            {
+                auto pos = p.rfind('/');
+                if (pos == p.npos || pos == 0)
+                    break;
+                p.resize(pos);
+            }
+        };
+        for (auto &i : request.inputs())
+        {
+            if (!isValidPath(i.path()))
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "bad input path: " + i.path());
+            if (!isValidHash(i.hash()) || !fs::exists(getBlob(i.hash())))
+                return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "missing blob: " + i.hash());
+            add_known(i.path());
+        }
+        for (auto &p : request.outputs())
+        {
+            if (!isValidPath(p))
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "bad output path: " + p);
+            add_known(p);
+        }
+        for (auto &p : request.output_dirs())
+        {
+            if (!isValidPath(p))
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "bad output dir: " + p);
+            add_known(p);
+        }
+        if (!request.working_directory().empty())
+        {
+            if (!isValidPath(request.working_directory()))
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "bad working directory: " + request.working_directory());
+            add_known(request.working_directory());
+        }
+
+        // remote cache
+        auto action = dir / "actions" / getActionKey(request);
+        if (fs::exists(action) && response.ParseFromString(read_file(action)))
+        {
+            LOG_TRACE(logger, "cached: " << request.program());
+            return grpc::Status::OK;
+        }
+        response.Clear();
+
+        auto scratch = dir / "scratch" / unique_path();
+        SCOPE_EXIT
+        {
+            error_code ec;
+            fs::remove_all(scratch, ec);
+        };
+        const auto root = normalize_path(scratch);
+        auto remap = [&root](const String &p) { return root + p; };
+
+        std::unordered_set<String> inputs;
+        for (auto &i : request.inputs())
+        {
+            path p = remap(i.path());
+            fs::create_directories(p.parent_path());
+            error_code ec;
+            fs::create_hard_link(getBlob(i.hash()), p, ec);
+            if (ec)
+                fs::copy_file(getBlob(i.hash()), p);
+            inputs.insert(normalize_path(p));
+        }
+        for (auto &o : request.outputs())
+            fs::create_directories(path(remap(o)).parent_path());
+        for (auto &d : request.output_dirs())
+            fs::create_directories(remap(d));
+
+        // rewrite known absolute paths in arguments: /path, -I/path, -o/path, --opt=/path
+        // macro definitions are left as is
+        auto remap_arg = [&known, &remap](const String &a) -> String
+        {
+            if (a.empty())
+                return a;
+            if (a[0] == '/')
+                return known.count(a) ? remap(a) : a;
+            if (a[0] != '-' || boost::starts_with(a, "-D") || boost::starts_with(a, "-U"))
+                return a;
+            auto p = a.find('/');
+            if (p == a.npos)
+                return a;
+            auto s = a.substr(p);
+            return known.count(s) ? a.substr(0, p) + remap(s) : a;
+        };
+
+        primitives::Command c;
+        c.setProgram(request.program());
+        for (auto &a : request.arguments())
+            c.push_back(remap_arg(a));
+        // hide scratch dir from debug info, __FILE__ etc.
+        if (!request.prefix_map_option().empty())
+            c.push_back(request.prefix_map_option() + root + "=");
+        if (!request.working_directory().empty())
+        {
+            c.working_directory = remap(request.working_directory());
+            fs::create_directories(c.working_directory);
+        }
+        for (auto &[k, v] : request.environment())
+            c.environment[k] = v;
+
+        error_code ec;
+        c.execute(ec);
+        response.set_exit_code(c.exit_code ? c.exit_code.value() : -1);
+        boost::replace_all(c.out.text, root, "");
+        boost::replace_all(c.err.text, root, "");
+        if (ec && !c.exit_code)
+            c.err.text += ec.message();
+        response.set_out(c.out.text);
+        response.set_err(c.err.text);
+        if (response.exit_code())
+            return grpc::Status::OK;
+
+        for (auto &f : fs::recursive_directory_iterator(scratch))
+        {
+            if (!f.is_regular_file())
+                continue;
+            auto p = normalize_path(f.path());
+            if (inputs.count(p))
+                continue;
+            auto data = read_file(f.path());
+            // text outputs (e.g. dependency files) mention scratch dir
+            if (data.find('\0') == data.npos)
+                boost::replace_all(data, root, "");
+            auto o = response.add_outputs();
+            o->set_path(p.substr(root.size()));
+            o->set_data(data);
+        }
+
+        writeAtomically(action, response.SerializeAsString());
+        return grpc::Status::OK;
+    }
+};
+
+}
+
+static bool isLoopbackAddress(const String &address)
+{
+    if (boost::starts_with(address, "unix:"))
+        return true;
+    auto host = address.substr(0, address.rfind(':'));
+    if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    return host == "localhost" || host == "::1" || boost::starts_with(host, "127.");
+}
+
+void runRemoteWorker(const RemoteWorkerOptions &o)
+{
+    // commands of any client are executed, so access must be explicit
+    auto tls = !o.tls_cert.empty() && !o.tls_key.empty();
+    if (!isLoopbackAddress(o.address))
+    {
+        if (!o.allow_remote)
+            throw SW_RUNTIME_ERROR("Listening on non loopback address " + o.address + " must be allowed explicitly");
+        if (o.token.empty() && !tls)
+            throw SW_RUNTIME_ERROR("Access token or tls is required to listen on non loopback address " + o.address);
+    }
+    if (o.allowed_programs.empty())
+        throw SW_RUNTIME_ERROR("No programs are allowed to run, set toolchain paths");
+
+    RemoteWorker service(o);
+
+    auto creds = grpc::InsecureServerCredentials();
+    if (tls)
+    {
+        grpc::SslServerCredentialsOptions so;
+        so.pem_key_cert_pairs.push_back({ read_file(o.tls_key), read_file(o.tls_cert) });
+        creds = grpc::SslServerCredentials(so);
+    }
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(o.address, creds);
+    builder.RegisterService(&service);
+    builder.SetMaxReceiveMessageSize(max_message_size);
+    builder.SetMaxSendMessageSize(max_message_size);
+    auto server = builder.BuildAndStart();
+    if (!server)
+        throw SW_RUNTIME_ERROR("Cannot start remote worker on " + o.address);
+    LOG_INFO(logger, "Remote worker is listening on " << o.address << (tls ? " (tls)" : "") << ", storage: " << normalize_path(o.dir));
+    server->Wait();
+}
+
+}
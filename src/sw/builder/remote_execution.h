@@ -0,0 +1,78 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace sw
+{
+
+namespace builder { struct Command; }
+
+/// Client side of DistributedBuildService.
+///
+/// Ships commands marked as remote executable with their inputs and implicit inputs
+/// (from the previous run) to workers. Each worker runs up to N commands at once,
+/// when all of them are busy, command is executed locally.
+/// Any remote failure (including non zero exit code) also falls back to local run,
+/// so diagnostics always come from the local toolchain.
+struct SW_BUILDER_API RemoteExecutor
+{
+    struct Worker;
+
+    std::atomic_size_t executed = 0;
+    std::atomic_size_t failed = 0;
+
+    RemoteExecutor(const Strings &addresses, int jobs_per_worker);
+    ~RemoteExecutor();
+
+    /// nullptr when there are no workers in options
+    static std::unique_ptr<RemoteExecutor> create();
+
+    /// false if command must be executed locally
+    bool execute(builder::Command &c);
+
+    /// prints and resets counters
+    String printStats();
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers;
+    int jobs_per_worker;
+    std::atomic_size_t next = 0;
+
+    Worker *acquireWorker();
+};
+
+struct RemoteWorkerOptions
+{
+    String address = "127.0.0.1:7070";
+    /// blob store, result cache and scratch dirs
+    path dir;
+    /// only programs from these files or dirs are executed (toolchains)
+    Files allowed_programs;
+    /// clients must send it, required for non loopback addresses (unless tls is used)
+    String token;
+    /// server certificate and key in pem, tls is used when both are set
+    path tls_cert;
+    path tls_key;
+    /// explicit permission to listen on non loopback addresses
+    bool allow_remote = false;
+};
+
+/// Worker side of DistributedBuildService.
+///
+/// dir contains content addressed blob store, cache of successful results
+/// and scratch dirs where inputs are materialized under client absolute paths.
+/// Blocks forever.
+SW_BUILDER_API
+void runRemoteWorker(const RemoteWorkerOptions &);
+
+}
@@ -0,0 +1,75 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "show_includes.h"
+
+namespace sw
+{
+
+ShowIncludesFilter::ShowIncludesFilter(const String &prefix)
+    : prefix(prefix)
+{
+}
+
+void ShowIncludesFilter::feed(std::string_view s)
+{
+    if (s.empty())
+        return;
+    fed_ = true;
+    while (!s.empty())
+    {
+        auto p = s.find('\n');
+        if (p == s.npos)
+        {
+            line.append(s.data(), s.size());
+            return;
+        }
+        // complete lines are processed in place
+        if (line.empty())
+            processLine(s.substr(0, p));
+        else
+        {
+            line.append(s.data(), p);
+            processLine(line);
+            line.clear();
+        }
+        s.remove_prefix(p + 1);
+    }
+}
+
+void ShowIncludesFilter::finish()
+{
+    if (line.empty())
+        return;
+    processLine(line);
+    line.clear();
+}
+
+void ShowIncludesFilter::processLine(std::string_view s)
+{
+    // remove filename
+    if (first)
+    {
+        first = false;
+        return;
+    }
+    if (s.compare(0, prefix.size(), prefix) != 0)
+    {
+        text.append(s.data(), s.size());
+        text += "\n";
+        return;
+    }
+    s.remove_prefix(prefix.size());
+    auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    while (!s.empty() && is_space(s.front()))
+        s.remove_prefix(1);
+    while (!s.empty() && is_space(s.back()))
+        s.remove_suffix(1);
+    if (!s.empty())
+        includes.emplace_back(s);
+}
+
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <primitives/string.h>
+
+#include <string_view>
+
+namespace sw
+{
+
+/// Streaming filter of /showIncludes output of msvc and clang-cl.
+///
+/// Output is fed in chunks as they come from the child process.
+/// Include lines are collected, other lines (diagnostics) are kept in text.
+/// The first line (name of compiled file) is dropped.
+struct SW_BUILDER_API ShowIncludesFilter
+{
+    /// output without include lines
+    String text;
+    /// trimmed paths from include lines, in order of appearance
+    Strings includes;
+
+    /// prefix is locale dependent: "Note: including file:"
+    ShowIncludesFilter(const String &prefix);
+
+    void feed(std::string_view chunk);
+    /// processes the last line without eol
+    void finish();
+
+    /// true if some output was fed
+    bool fed() const { return fed_; }
+
+private:
+    String prefix;
+    // incomplete line from previous chunks
+    String line;
+    bool first = true;
+    bool fed_ = false;
+
+    void processLine(std::string_view);
+};
+
+}
@@ -0,0 +1,141 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "stable_hash.h"
+
+#include <cstring>
+
+namespace sw
+{
+
+String Hash128::toString() const
+{
+    static const char digits[] = "0123456789abcdef";
+    String s(32, '0');
+    for (int i = 0; i < 16; i++)
+    {
+        s[15 - i] = digits[(hi >> (i * 4)) & 0xF];
+        s[31 - i] = digits[(lo >> (i * 4)) & 0xF];
+    }
+    return s;
+}
+
+Hasher128 &Hasher128::update(const void *data, size_t sz)
+{
+    // prime is 2^88 + 0x13B, so multiplication is a shift and a small product
+    static const uint64_t k = 0x13B;
+    auto p = (const uint8_t *)data;
+    for (size_t i = 0; i < sz; i++)
+    {
+        h.lo ^= p[i];
+        auto lo_k_hi = ((h.lo >> 32) * k + (((h.lo & 0xFFFFFFFF) * k) >> 32)) >> 32;
+        auto hi = h.hi * k + lo_k_hi + (h.lo << 24);
+        h.lo *= k;
+        h.hi = hi;
+    }
+    return *this;
+}
+
+Hasher128 &Hasher128::update(const String &s)
+{
+    update((uint64_t)s.size());
+    return update(s.data(), s.size());
+}
+
+Hasher128 &Hasher128::update(uint64_t v)
+{
+    uint8_t b[sizeof(v)];
+    for (size_t i = 0; i < sizeof(v); i++)
+        b[i] = (uint8_t)(v >> (i * 8));
+    return update(b, sizeof(b));
+}
+
+static const uint64_t xxh_prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t xxh_prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t xxh_prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t xxh_prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t xxh_prime5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotl(uint64_t v, int r)
+{
+    return (v << r) | (v >> (64 - r));
+}
+
+// little endian, memcpy is a single load
+template <class T>
+static T read(const uint8_t *p)
+{
+    T v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    T r = 0;
+    for (size_t i = 0; i < sizeof(T); i++)
+        r = (r << 8) | ((v >> (i * 8)) & 0xFF);
+    v = r;
+#endif
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t v)
+{
+    return rotl(acc + v * xxh_prime2, 31) * xxh_prime1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t v)
+{
+    return (acc ^ xxh64_round(0, v)) * xxh_prime1 + xxh_prime4;
+}
+
+uint64_t xxh64(const void *data, size_t sz, uint64_t seed)
+{
+    auto p = (const uint8_t *)data;
+    auto end = p + sz;
+    uint64_t h;
+
+    if (sz >= 32)
+    {
+        // four independent lanes
+        uint64_t v1 = seed + xxh_prime1 + xxh_prime2;
+        uint64_t v2 = seed + xxh_prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - xxh_prime1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = xxh64_round(v1, read<uint64_t>(p));
+            v2 = xxh64_round(v2, read<uint64_t>(p + 8));
+            v3 = xxh64_round(v3, read<uint64_t>(p + 16));
+            v4 = xxh64_round(v4, read<uint64_t>(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }
+    else
+        h = seed + xxh_prime5;
+    h += sz;
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ xxh64_round(0, read<uint64_t>(p)), 27) * xxh_prime1 + xxh_prime4;
+    if (p + 4 <= end)
+    {
+        h = rotl(h ^ (read<uint32_t>(p) * xxh_prime1), 23) * xxh_prime2 + xxh_prime3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl(h ^ (*p * xxh_prime5), 11) * xxh_prime1;
+
+    // avalanche
+    h ^= h >> 33;
+    h *= xxh_prime2;
+    h ^= h >> 29;
+    h *= xxh_prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+}
@@ -0,0 +1,74 @@
+// Copyright (C) 2019 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <primitives/string.h>
+
+#include <functional>
+
+namespace sw
+{
+
+/// 128-bit hash, stable between platforms, standard libraries and runs.
+/// Used as command and file ids in command db.
+struct SW_BUILDER_API Hash128
+{
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    explicit operator bool() const { return lo || hi; }
+    bool operator==(const Hash128 &rhs) const { return lo == rhs.lo && hi == rhs.hi; }
+    bool operator!=(const Hash128 &rhs) const { return !operator==(rhs); }
+    bool operator<(const Hash128 &rhs) const { return hi < rhs.hi || (hi == rhs.hi && lo < rhs.lo); }
+
+    /// order independent combination (sum modulo 2^128)
+    Hash128 &operator+=(const Hash128 &rhs)
+    {
+        lo += rhs.lo;
+        hi += rhs.hi + (lo < rhs.lo);
+        return *this;
+    }
+
+    /// 32 hex digits
+    String toString() const;
+};
+
+/// Streaming FNV-1a 128.
+struct SW_BUILDER_API Hasher128
+{
+    Hasher128 &update(const void *p, size_t sz);
+    /// length prefixed, so sequences of strings do not collide
+    Hasher128 &update(const String &s);
+    /// little endian
+    Hasher128 &update(uint64_t v);
+    Hasher128 &update(const Hash128 &h) { return update(h.lo).update(h.hi); }
+
+    Hash128 digest() const { return h; }
+
+private:
+    Hash128 h{ 0x62b821756295c58dULL, 0x6c62272e07bb0142ULL }; // offset basis
+};
+
+/// XXH64, for file contents where byte at a time FNV is too slow.
+/// Same values as reference implementation.
+SW_BUILDER_API
+uint64_t xxh64(const void *p, size_t sz, uint64_t seed = 0);
+
+}
+
+namespace std
+{
+
+template<> struct hash<sw::Hash128>
+{
+    size_t operator()(const sw::Hash128 &h) const
+    {
+        return h.lo ^ h.hi;
+    }
+};
+
+}
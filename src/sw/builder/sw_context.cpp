@@ -8,7 +8,9 @@
 
 #include "command_storage.h"
 #include "file_storage.h"
+#include "output_cache.h"
 #include "program_version_storage.h"
+#include "remote_execution.h"
 
 #include <sw/manager/storage.h>
 
@@ -33,6 +35,9 @@ SwBuilderContext::SwBuilderContext(const path &local_storage_root_dir)
 
     //
     pvs = std::make_unique<ProgramVersionStorage>(getLocalStorage().storage_dir_tmp / "db" / "program_versions.txt");
+
+    output_cache = OutputCache::create(getLocalStorage().storage_dir_tmp / "cache" / "outputs");
+    remote_executor = RemoteExecutor::create();
 }
 
 SwBuilderContext::~SwBuilderContext()
@@ -72,6 +77,16 @@ CommandStorage &SwBuilderContext::getCommandStorage() const
     return *cs;
 }
 
+OutputCache *SwBuilderContext::getOutputCache() const
+{
+    return output_cache.get();
+}
+
+RemoteExecutor *SwBuilderContext::getRemoteExecutor() const
+{
+    return remote_executor.get();
+}
+
 ProgramVersionStorage &SwBuilderContext::getVersionStorage() const
 {
     return *pvs;
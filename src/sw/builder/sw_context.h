@@ -22,6 +22,8 @@ namespace sw
 struct CommandStorage;
 struct FileData;
 struct FileStorage;
+struct OutputCache;
+struct RemoteExecutor;
 struct ProgramVersionStorage;
 
 namespace builder::detail { struct ResolvableCommand; }
@@ -38,6 +40,10 @@ struct SW_BUILDER_API SwBuilderContext : SwManagerContext
     Executor &getFileStorageExecutor() const;
     CommandStorage &getCommandStorage() const;
     ModuleStorage &getModuleStorage() const;
+    /// nullptr when output cache is disabled
+    OutputCache *getOutputCache() const;
+    /// nullptr when remote workers are not set
+    RemoteExecutor *getRemoteExecutor() const;
     const OS &getHostOs() const { return HostOS; }
 
     void clearFileStorages();
@@ -48,6 +54,8 @@ private:
     std::unique_ptr<ProgramVersionStorage> pvs;
     mutable std::unique_ptr<CommandStorage> cs;
     mutable std::unique_ptr<FileStorage> file_storage;
+    std::unique_ptr<OutputCache> output_cache;
+    std::unique_ptr<RemoteExecutor> remote_executor;
     std::unique_ptr<Executor> file_storage_executor; // after everything!
 
     mutable std::mutex csm;
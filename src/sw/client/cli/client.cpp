@@ -133,6 +133,7 @@ extern std::map<sw::PackagePath, sw::Version> gUserSelectedPackages;
 static ::cl::list<String> cl_activate("activate", ::cl::desc("Activate specific packages"));
 
 extern ::cl::opt<path> build_ide_fast_path;
+extern ::cl::opt<bool> build_watch;
 
 #define SUBCOMMAND(n) extern ::cl::SubCommand subcommand_##n;
 #include "command/commands.inl"
@@ -207,17 +208,6 @@ int setup_main(const Strings &args)
         return 0;
     }
 
-    // before storages
-    // Create QSBR context for the main thread.
-    //auto context = createConcurrentContext();
-    //getConcurrentContext(&context);
-
-    SCOPE_EXIT
-    {
-        // Destroy the QSBR context for the main thread.
-        //destroyConcurrentContext(context);
-    };
-
     if (!build_ide_fast_path.empty() && fs::exists(build_ide_fast_path))
     {
         auto files = read_lines(build_ide_fast_path);
@@ -392,6 +382,10 @@ int sw_main(const Strings &args)
         return 0;
     }*/
 
+    // thin client mode
+    if ((subcommand_build || subcommand_b) && !build_watch && forwardToServer(args))
+        return 0;
+
     if (0);
 #define SUBCOMMAND(n) else if (subcommand_##n) { cli_##n(); return 0; }
 #include "command/commands.inl"
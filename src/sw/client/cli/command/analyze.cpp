@@ -0,0 +1,187 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2019 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "commands.h"
+#include "../generator/generator.h"
+
+#include <sw/builder/execution_plan.h>
+#include <sw/core/build.h>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "analyze");
+
+DEFINE_SUBCOMMAND(analyze, "Analyze build using data of previous runs.");
+
+static ::cl::opt<String> analyze_what(::cl::Positional, ::cl::desc("What to analyze: headers"), ::cl::Required, ::cl::sub(subcommand_analyze));
+static ::cl::list<String> analyze_arg(::cl::Positional, ::cl::desc("Files or directories to analyze (paths to config)"), ::cl::sub(subcommand_analyze));
+
+static ::cl::opt<int> analyze_top("top", ::cl::desc("Number of headers to print"), ::cl::init(30), ::cl::sub(subcommand_analyze));
+static ::cl::opt<int> analyze_pch_threshold("pch-threshold", ::cl::desc("Percent of target's translation units that must include header to make it a pch candidate"), ::cl::init(50), ::cl::sub(subcommand_analyze));
+static ::cl::opt<bool> analyze_suggest_pch("suggest-pch", ::cl::desc("Write suggested precompiled header for every target"), ::cl::sub(subcommand_analyze));
+
+namespace
+{
+
+struct HeaderStats
+{
+    // number of translation units including this header
+    size_t tus = 0;
+    // summed compile time of those translation units
+    std::chrono::milliseconds time{ 0 };
+};
+
+struct TargetStats
+{
+    size_t tus = 0;
+    std::chrono::milliseconds time{ 0 };
+    std::map<path, HeaderStats> headers;
+};
+
+}
+
+static String print_time(std::chrono::milliseconds t)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.1fs", t.count() / 1000.0);
+    return buf;
+}
+
+// headers included by large share of target's tus, most costly first
+static std::vector<std::pair<path, HeaderStats>> getPchCandidates(const TargetStats &t)
+{
+    std::vector<std::pair<path, HeaderStats>> c;
+    for (auto &[h, s] : t.headers)
+    {
+        if (s.tus > 1 && s.tus * 100 >= t.tus * analyze_pch_threshold)
+            c.emplace_back(h, s);
+    }
+    std::stable_sort(c.begin(), c.end(), [](const auto &a, const auto &b) { return a.second.time > b.second.time; });
+    return c;
+}
+
+static void analyze_headers(sw::SwBuild &b)
+{
+    // prepares commands, so their records can be found
+    auto ep = b.getExecutionPlan();
+
+    std::map<String, TargetStats> targets;
+    std::map<path, HeaderStats> headers;
+    size_t tus = 0, unknown = 0;
+    for (auto &[pkg, tgts] : b.getTargetsToBuild())
+    {
+        // filter out predefined targets
+        if (b.getContext().getPredefinedTargets().find(pkg) != b.getContext().getPredefinedTargets().end())
+            continue;
+        for (auto &tgt : tgts)
+        {
+            for (auto &c : tgt->getCommands())
+            {
+                // compile commands only, as in compilation database
+                if (c->inputs.empty() || c->working_directory.empty())
+                    continue;
+                if (std::none_of(c->inputs.begin(), c->inputs.end(), [](const auto &i)
+                {
+                    return CompilationDatabaseGenerator::isSourceFile(i);
+                }))
+                    continue;
+
+                // the input itself and sources included into unity files are not headers
+                Files ii;
+                for (auto &i : c->getStoredImplicitInputs())
+                {
+                    if (!CompilationDatabaseGenerator::isSourceFile(i))
+                        ii.insert(i);
+                }
+                auto d = c->getExpectedDuration();
+                if (ii.empty() || d.count() == 0)
+                {
+                    unknown++;
+                    continue;
+                }
+
+                tus++;
+                auto &t = targets[pkg.toString()];
+                t.tus++;
+                t.time += d;
+                for (auto &h : ii)
+                {
+                    for (auto s : { &t.headers[h], &headers[h] })
+                    {
+                        s->tus++;
+                        s->time += d;
+                    }
+                }
+            }
+        }
+    }
+
+    if (unknown)
+        LOG_WARN(logger, unknown << " translation unit(s) have no data, build them first");
+    if (!tus)
+        return;
+
+    std::vector<std::pair<path, HeaderStats>> sorted(headers.begin(), headers.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.second.time > b.second.time; });
+    if (sorted.size() > (size_t)analyze_top)
+        sorted.resize(analyze_top);
+
+    LOG_INFO(logger, "Headers by summed compile time of including translation units (" << tus << " in total):");
+    for (auto &[h, s] : sorted)
+        LOG_INFO(logger, "  " << print_time(s.time) << "  " << s.tus << " tu(s)  " << normalize_path(h));
+
+    for (auto &[pkg, t] : targets)
+    {
+        auto c = getPchCandidates(t);
+        if (c.empty())
+            continue;
+
+        LOG_INFO(logger, "");
+        LOG_INFO(logger, "Pch candidates for " << pkg << " (" << t.tus << " tu(s), " << print_time(t.time) << "):");
+        for (size_t i = 0; i < std::min<size_t>(c.size(), analyze_top); i++)
+            LOG_INFO(logger, "  " << print_time(c[i].second.time) << "  " << c[i].second.tus << " tu(s)  " << normalize_path(c[i].first));
+
+        if (!analyze_suggest_pch)
+            continue;
+
+        // most used go first, they are often included by others
+        std::stable_sort(c.begin(), c.end(), [](const auto &a, const auto &b) { return a.second.tus > b.second.tus; });
+        String s;
+        s += "// suggested by 'sw analyze headers' for " + pkg + "\n";
+        s += "// " + std::to_string(t.tus) + " tu(s), headers included by at least " + std::to_string(analyze_pch_threshold) + "% of them\n\n";
+        s += "#pragma once\n\n";
+        for (auto &[h, _] : c)
+            s += "#include \"" + normalize_path(h) + "\"\n";
+        auto fn = b.getBuildDirectory() / "analyze" / "pch" / (pkg + ".h");
+        write_file(fn, s);
+        LOG_INFO(logger, "Suggested precompiled header (use with addPrecompiledHeader()): " << normalize_path(fn));
+    }
+}
+
+SUBCOMMAND_DECL(analyze)
+{
+    if (analyze_arg.empty())
+        analyze_arg.push_back(".");
+
+    auto swctx = createSwContext();
+    auto b = setBuildArgsAndCreateBuildAndPrepare(*swctx, (Strings &)analyze_arg);
+    if (analyze_what == "headers")
+        analyze_headers(*b);
+    else
+        throw SW_RUNTIME_ERROR("Unknown analysis: " + analyze_what);
+}
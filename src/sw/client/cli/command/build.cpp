@@ -19,6 +19,8 @@
 #include "commands.h"
 
 #include <sw/builder/execution_plan.h>
+#include <sw/builder/file_storage.h>
+#include <sw/builder/file_watcher.h>
 #include <sw/core/input.h>
 
 #include <boost/algorithm/string.hpp>
@@ -40,12 +42,15 @@ static ::cl::opt<bool> build_fetch("fetch", ::cl::desc("Fetch sources, then buil
 static ::cl::opt<path> build_explan("ef", ::cl::desc("Build execution plan from specified file"), ::cl::sub(subcommand_build));
 static ::cl::opt<bool> build_default_explan("e", ::cl::desc("Build execution plan"), ::cl::sub(subcommand_build));
 
+::cl::opt<bool> build_watch("watch", ::cl::desc("Rebuild when files are changed"), ::cl::sub(subcommand_build));
+
 static ::cl::opt<bool> isolated_build("isolated", cl::desc("Copy source files to isolated folders to check build like just after uploading"), ::cl::sub(subcommand_build));
 
 ::cl::opt<path> build_ide_fast_path("ide-fast-path", ::cl::sub(subcommand_build), ::cl::Hidden);
 static ::cl::opt<path> build_ide_copy_to_dir("ide-copy-to-dir", ::cl::sub(subcommand_build), ::cl::Hidden);
 
 static ::cl::opt<String> time_limit("time-limit", ::cl::sub(subcommand_build));
+static ::cl::opt<String> memory_limit("memory-limit", ::cl::desc("Limit sum of expected peak memory of running commands (e.g. 48G)"), ::cl::sub(subcommand_build));
 
 //
 
@@ -54,6 +59,7 @@ static ::cl::opt<String> time_limit("time-limit", ::cl::sub(subcommand_build));
 static cl::opt<bool> build_always("B", cl::desc("Build always"));
 static cl::opt<int> skip_errors("k", cl::desc("Skip errors"));
 static cl::opt<bool> time_trace("time-trace", cl::desc("Record chrome time trace events"));
+static cl::opt<bool> work_stealing("work-stealing", cl::desc("Use per thread queues with work stealing to execute commands"));
 
 static cl::opt<bool> cl_show_output("show-output");
 static cl::opt<bool> cl_write_output_to_file("write-output-to-file");
@@ -111,12 +117,47 @@ static cl::alias win_md2("md", cl::desc("Alias for -win-md"), cl::aliasopt(win_m
 
 ////////////////////////////////////////////////////////////////////////////////
 
-SUBCOMMAND_DECL(build)
+static void watch_build(sw::SwContext &swctx)
 {
-    if (build_arg.empty() && input_settings_pairs.empty())
-        build_arg.push_back(".");
+    sw::FileWatcher w(swctx.getFileStorage());
+    swctx.getFileStorage().watcher = &w;
+    SCOPE_EXIT
+    {
+        swctx.getFileStorage().watcher = nullptr;
+    };
+
+    // new files in source dirs
+    for (const path p : build_arg)
+        w.addDirectory(fs::is_directory(p) ? fs::absolute(p) : fs::absolute(p).parent_path());
+    if (build_arg.empty())
+        w.addDirectory(fs::current_path());
+
+    while (1)
+    {
+        try
+        {
+            cli_build(swctx);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR(logger, e.what());
+        }
+
+        LOG_INFO(logger, "Waiting for changes...");
+        auto files = w.wait();
+        if (files.empty())
+            LOG_INFO(logger, "Rebuilding");
+        else
+            LOG_INFO(logger, "Rebuilding: " << normalize_path(*files.begin())
+                << (files.size() > 1 ? " and " + std::to_string(files.size() - 1) + " more file(s)" : ""));
+    }
+}
 
+SUBCOMMAND_DECL(build)
+{
     auto swctx = createSwContext();
+    if (build_watch)
+        return watch_build(*swctx);
     cli_build(*swctx);
 }
 
@@ -654,6 +695,10 @@ std::unique_ptr<sw::SwBuild> createBuild(sw::SwContext &swctx)
         bs["write_output_to_file"] = "true";
     if (!time_limit.empty())
         bs["time_limit"] = time_limit;
+    if (work_stealing)
+        bs["work_stealing"] = "true";
+    if (!memory_limit.empty())
+        bs["memory_limit"] = memory_limit;
     b->setSettings(bs);
 
     return b;
@@ -661,6 +706,9 @@ std::unique_ptr<sw::SwBuild> createBuild(sw::SwContext &swctx)
 
 SUBCOMMAND_DECL2(build)
 {
+    if (build_arg.empty() && input_settings_pairs.empty())
+        build_arg.push_back(".");
+
     if (!build_explan.empty())
     {
         auto b = createBuild(swctx);
@@ -56,3 +56,5 @@ std::vector<sw::TargetSettings> createSettings(sw::SwContext &);
 std::unique_ptr<sw::SwBuild> setBuildArgsAndCreateBuildAndPrepare(sw::SwContext &, const Strings &inputs);
 std::unique_ptr<sw::SwBuild> createBuildAndPrepare(sw::SwContext &);
 std::map<sw::PackagePath, sw::VersionSet> getMatchingPackages(const sw::StorageWithPackagesDatabase &, const String &unresolved_arg);
+/// send build to running build server, false if there is no server
+bool forwardToServer(const Strings &args);
@@ -35,6 +35,7 @@ upgrade - upgrade installed pkgs
 self-upgrade - upgrade the client. implement via upgrade?
 */
 
+SUBCOMMAND(analyze) COMMA
 SUBCOMMAND(build) COMMA
 SUBCOMMAND(b) COMMA // alias for build
 SUBCOMMAND(configure) COMMA
@@ -52,11 +53,13 @@ SUBCOMMAND(override) COMMA
 //SUBCOMMAND(pack, "Used to prepare distribution packages.") COMMA
 SUBCOMMAND(remote) COMMA
 SUBCOMMAND(remove) COMMA
+SUBCOMMAND(server) COMMA
 SUBCOMMAND(setup) COMMA
 SUBCOMMAND(test) COMMA
 SUBCOMMAND(update) COMMA
 SUBCOMMAND(upload) COMMA
 SUBCOMMAND(uri) COMMA
+SUBCOMMAND(worker) COMMA
 
 #ifdef SW_COMMA_SELF
 #undef COMMA
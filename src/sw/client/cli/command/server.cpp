@@ -0,0 +1,348 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2019 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "commands.h"
+
+#include <sw/builder/file_storage.h>
+#include <sw/builder/file_watcher.h>
+#include <sw/support/exceptions.h>
+#include <sw/support/filesystem.h>
+
+#include <primitives/templates.h>
+
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "server");
+
+DEFINE_SUBCOMMAND(server, "Keep build context in memory and serve build requests.");
+
+extern ::cl::SubCommand subcommand_build;
+extern ::cl::SubCommand subcommand_b;
+
+static ::cl::opt<path> server_socket("server-socket", ::cl::desc("Build server socket (default is <sw root>/server.sock)"));
+static ::cl::opt<bool> standalone("standalone", ::cl::desc("Do not forward build to running build server"));
+
+#ifndef _WIN32
+
+// output is sent as is, then zero byte and int32 exit status
+static const size_t status_size = 1 + sizeof(int32_t);
+
+namespace
+{
+
+struct Socket
+{
+    int fd = -1;
+
+    Socket() = default;
+    Socket(int fd) : fd(fd)
+    {
+        if (fd != -1)
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    Socket(Socket &&rhs) : fd(rhs.fd) { rhs.fd = -1; }
+    Socket(const Socket &) = delete;
+    Socket &operator=(const Socket &) = delete;
+    ~Socket()
+    {
+        if (fd != -1)
+            close(fd);
+    }
+
+    explicit operator bool() const { return fd != -1; }
+};
+
+}
+
+static path getSocketPath()
+{
+    if (!server_socket.empty())
+        return server_socket;
+    return sw::get_root_directory() / "server.sock";
+}
+
+static sockaddr_un makeAddress(const path &p)
+{
+    sockaddr_un a{};
+    a.sun_family = AF_UNIX;
+    auto s = p.u8string();
+    if (s.size() >= sizeof(a.sun_path))
+        throw SW_RUNTIME_ERROR("Build server socket path is too long: " + s);
+    strcpy(a.sun_path, s.c_str());
+    return a;
+}
+
+static Socket connectToServer(const path &p)
+{
+    Socket s(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!s)
+        throw SW_RUNTIME_ERROR("Cannot create socket");
+    auto a = makeAddress(p);
+    if (connect(s.fd, (sockaddr *)&a, sizeof(a)) == -1)
+        return {};
+    return s;
+}
+
+static void writeAll(int fd, const void *data, size_t sz)
+{
+    auto p = (const char *)data;
+    while (sz)
+    {
+        auto r = write(fd, p, sz);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            throw SW_RUNTIME_ERROR("Cannot write to build server socket");
+        p += r;
+        sz -= r;
+    }
+}
+
+static void readAll(int fd, void *data, size_t sz)
+{
+    auto p = (char *)data;
+    while (sz)
+    {
+        auto r = read(fd, p, sz);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            throw SW_RUNTIME_ERROR("Cannot read from build server socket");
+        p += r;
+        sz -= r;
+    }
+}
+
+static void writeStrings(int fd, const Strings &v)
+{
+    uint32_t n = v.size();
+    writeAll(fd, &n, sizeof(n));
+    for (auto &s : v)
+    {
+        uint32_t len = s.size();
+        writeAll(fd, &len, sizeof(len));
+        writeAll(fd, s.data(), len);
+    }
+}
+
+static Strings readStrings(int fd)
+{
+    uint32_t n;
+    readAll(fd, &n, sizeof(n));
+    if (n > 1 << 16)
+        throw SW_RUNTIME_ERROR("Bad build request");
+    Strings v(n);
+    for (auto &s : v)
+    {
+        uint32_t len;
+        readAll(fd, &len, sizeof(len));
+        if (len > 1 << 20)
+            throw SW_RUNTIME_ERROR("Bad build request");
+        s.resize(len);
+        readAll(fd, s.data(), len);
+    }
+    return v;
+}
+
+static void runRequest(sw::SwContext &swctx, sw::FileWatcher &w, const Strings &request)
+{
+    fs::current_path(request[0]);
+
+    // client has already parsed these args with the same binary, so they are valid
+    Strings args(request.begin() + 1, request.end());
+    ::cl::ResetAllOptionOccurrences();
+    ::cl::ParseCommandLineOptions(args);
+    if (!subcommand_build && !subcommand_b)
+        throw SW_RUNTIME_ERROR("Only build requests are served");
+
+    // files could be changed since previous build, only touched ones are reset
+    w.poll();
+    cli_build(swctx);
+}
+
+static void serve(sw::SwContext &swctx, sw::FileWatcher &w, int fd)
+{
+    auto request = readStrings(fd);
+    if (request.size() < 2)
+        throw SW_RUNTIME_ERROR("Bad build request");
+    LOG_INFO(logger, "Building in " << request[0]);
+
+    // send all output of this build to the client
+    std::cout.flush();
+    std::cerr.flush();
+    auto saved_out = dup(1);
+    auto saved_err = dup(2);
+    dup2(fd, 1);
+    dup2(fd, 2);
+
+    int32_t status = 0;
+    try
+    {
+        runRequest(swctx, w, request);
+    }
+    catch (SupressOutputException &)
+    {
+        status = 1;
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR(logger, e.what());
+        status = 1;
+    }
+
+    LOG_FLUSH();
+    std::cout.flush();
+    std::cerr.flush();
+    dup2(saved_out, 1);
+    dup2(saved_err, 2);
+    close(saved_out);
+    close(saved_err);
+
+    char trailer[status_size] = {};
+    memcpy(trailer + 1, &status, sizeof(status));
+    writeAll(fd, trailer, sizeof(trailer));
+    LOG_INFO(logger, (status ? "Build failed" : "Build succeeded"));
+}
+
+#endif
+
+bool forwardToServer(const Strings &args)
+{
+#ifdef _WIN32
+    return false;
+#else
+    if (standalone)
+        return false;
+    auto s = connectToServer(getSocketPath());
+    if (!s)
+        return false;
+    LOG_TRACE(logger, "Forwarding build to server");
+
+    Strings request;
+    request.push_back(fs::current_path().u8string());
+    request.insert(request.end(), args.begin(), args.end());
+    writeStrings(s.fd, request);
+    shutdown(s.fd, SHUT_WR);
+
+    // print everything except status trailer
+    String buf;
+    char tmp[8192];
+    while (1)
+    {
+        auto r = read(s.fd, tmp, sizeof(tmp));
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r == -1)
+            throw SW_RUNTIME_ERROR("Cannot read from build server socket");
+        if (r == 0)
+            break;
+        buf.append(tmp, r);
+        if (buf.size() > status_size)
+        {
+            auto n = buf.size() - status_size;
+            std::cout.write(buf.data(), n);
+            std::cout.flush();
+            buf.erase(0, n);
+        }
+    }
+    if (buf.size() != status_size || buf[0] != 0)
+        throw SW_RUNTIME_ERROR("Build server closed connection unexpectedly");
+    int32_t status;
+    memcpy(&status, buf.data() + 1, sizeof(status));
+    if (status)
+        throw SupressOutputException(); // error is already printed
+    return true;
+#endif
+}
+
+SUBCOMMAND_DECL(server)
+{
+#ifdef _WIN32
+    SW_UNIMPLEMENTED;
+#else
+    auto p = getSocketPath();
+    if (connectToServer(p))
+        throw SW_RUNTIME_ERROR("Build server is already running: " + normalize_path(p));
+    fs::create_directories(p.parent_path());
+    fs::remove(p); // stale socket of killed server
+
+    Socket s(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!s)
+        throw SW_RUNTIME_ERROR("Cannot create socket");
+    auto a = makeAddress(p);
+    if (bind(s.fd, (sockaddr *)&a, sizeof(a)) == -1)
+        throw SW_RUNTIME_ERROR("Cannot bind build server socket: " + normalize_path(p));
+    SCOPE_EXIT
+    {
+        error_code ec;
+        fs::remove(p, ec);
+    };
+    if (listen(s.fd, 16) == -1)
+        throw SW_RUNTIME_ERROR("Cannot listen on build server socket: " + normalize_path(p));
+
+    // client may go away in the middle of the build
+    signal(SIGPIPE, SIG_IGN);
+
+    // everything expensive lives here between builds:
+    // host settings and compilers, command and file storages, loaded config modules
+    auto swctx = createSwContext();
+
+    // files registered from now on are watched, earlier ones are added here
+    // and reset once, they could be changed before the watch
+    sw::FileWatcher w(swctx->getFileStorage());
+    swctx->getFileStorage().watcher = &w;
+    SCOPE_EXIT
+    {
+        swctx->getFileStorage().watcher = nullptr;
+    };
+    for (const auto &[k, f] : swctx->getFileStorage().files)
+        w.addFile(sw::getPathInterner().getPath(k));
+    swctx->getFileStorage().reset();
+
+    LOG_INFO(logger, "Build server is listening on " << normalize_path(p));
+
+    // builds are executed one by one
+    while (1)
+    {
+        Socket c(accept(s.fd, nullptr, nullptr));
+        if (!c)
+        {
+            if (errno == EINTR)
+                continue;
+            throw SW_RUNTIME_ERROR("Cannot accept build server connection");
+        }
+        try
+        {
+            serve(*swctx, w, c.fd);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR(logger, "Cannot serve build request: " << e.what());
+        }
+    }
+#endif
+}
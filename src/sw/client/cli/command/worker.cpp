@@ -0,0 +1,50 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2019 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "commands.h"
+
+#include <sw/builder/remote_execution.h>
+#include <sw/support/filesystem.h>
+
+#include <boost/algorithm/string.hpp>
+
+DEFINE_SUBCOMMAND(worker, "Execute commands of remote builds.");
+
+static ::cl::opt<String> worker_listen("listen", ::cl::desc("Address to listen on"), ::cl::sub(subcommand_worker), ::cl::init("127.0.0.1:7070"));
+static ::cl::opt<path> worker_dir("worker-dir", ::cl::desc("Blob store, result cache and scratch dirs (default is <sw root>/worker)"), ::cl::sub(subcommand_worker));
+static ::cl::list<String> worker_allow_program("allow-program", ::cl::desc("Toolchain files or dirs which clients may run"), ::cl::sub(subcommand_worker), ::cl::CommaSeparated);
+static ::cl::opt<bool> worker_allow_remote("allow-remote", ::cl::desc("Allow listening on non loopback addresses (requires token or tls)"), ::cl::sub(subcommand_worker));
+static ::cl::opt<path> worker_token_file("token-file", ::cl::desc("File with access token clients must send"), ::cl::sub(subcommand_worker));
+static ::cl::opt<path> worker_tls_cert("tls-cert", ::cl::desc("Server certificate (pem)"), ::cl::sub(subcommand_worker));
+static ::cl::opt<path> worker_tls_key("tls-key", ::cl::desc("Server private key (pem)"), ::cl::sub(subcommand_worker));
+
+SUBCOMMAND_DECL(worker)
+{
+    // scratch dirs are unique, so several local workers may share one dir
+    sw::RemoteWorkerOptions o;
+    o.address = worker_listen;
+    o.dir = worker_dir.empty() ? sw::get_root_directory() / "worker" : path(worker_dir);
+    for (auto &p : worker_allow_program)
+        o.allowed_programs.insert(p);
+    o.allow_remote = worker_allow_remote;
+    if (!worker_token_file.empty())
+        o.token = boost::trim_copy(read_file(worker_token_file));
+    o.tls_cert = worker_tls_cert;
+    o.tls_key = worker_tls_key;
+    sw::runRemoteWorker(o);
+}
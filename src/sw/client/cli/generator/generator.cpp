@@ -400,14 +400,14 @@ private:
         if (b.getContext().getHostOs().Type == OSType::Windows)
             rsp = c.needsResponseFile(8000);
         path rsp_dir = getRspDir();
-        path rsp_file = fs::absolute(rsp_dir / (std::to_string(c.getHash()) + ".rsp"));
+        path rsp_file = fs::absolute(rsp_dir / (c.getHash().toString() + ".rsp"));
         if (rsp)
             fs::create_directories(rsp_dir);
 
         auto has_mmd = false;
         auto prog = c.getProgram();
 
-        addLine("rule c" + std::to_string(c.getHash()));
+        addLine("rule c" + c.getHash().toString());
         increaseIndent();
         addLine("description = " + c.getName());
         addLine("command = ");
@@ -497,7 +497,7 @@ private:
             addText(prepareString(b, getShortName(o)) + " ");
         //for (auto &o : c.intermediate)
             //addText(prepareString(b, getShortName(o)) + " ");
-        addText(": c" + std::to_string(c.getHash()) + " ");
+        addText(": c" + c.getHash().toString() + " ");
         for (auto &i : c.inputs)
             addText(prepareString(b, getShortName(i)) + " ");
         addLine();
@@ -585,9 +585,7 @@ struct MakeEmitter : primitives::Emitter
 
     void addCommand(const builder::Command &c, const path &d)
     {
-        std::stringstream stream;
-        stream << std::hex << c.getHash();
-        std::string result(stream.str());
+        auto result = c.getHash().toString();
 
         auto rsp = d / "rsp" / c.getResponseFilename();
 
@@ -680,7 +678,8 @@ struct MakeEmitter : primitives::Emitter
         }
     }
 
-    static String printFiles(const Files &inputs, bool quotes = false)
+    template <class F>
+    static String printFiles(const F &inputs, bool quotes = false)
     {
         String s;
         for (auto &f : inputs)
@@ -905,12 +904,16 @@ void ShellGenerator::generate(const SwBuild &b)
     write_file(d / ("commands"s + (batch ? ".bat" : ".sh")), ctx.getText());
 }
 
-void CompilationDatabaseGenerator::generate(const SwBuild &b)
+bool CompilationDatabaseGenerator::isSourceFile(const path &p)
 {
     static const std::set<String> exts{
         ".c", ".cpp", ".cxx", ".c++", ".cc", ".CPP", ".C++", ".CXX", ".C", ".CC"
     };
+    return exts.find(p.extension().string()) != exts.end();
+}
 
+void CompilationDatabaseGenerator::generate(const SwBuild &b)
+{
     const auto d = getRootDirectory(b);
 
     auto p = b.getExecutionPlan();
@@ -928,7 +931,7 @@ void CompilationDatabaseGenerator::generate(const SwBuild &b)
                     continue;
                 if (c->inputs.size() > 1)
                     continue;
-                if (exts.find(c->inputs.begin()->extension().string()) == exts.end())
+                if (!isSourceFile(*c->inputs.begin()))
                     continue;
                 nlohmann::json j2;
                 j2["directory"] = normalize_path(c->working_directory);
@@ -106,6 +106,9 @@ struct ShellGenerator : Generator
 struct CompilationDatabaseGenerator : Generator
 {
     void generate(const sw::SwBuild &b) override;
+
+    /// c/c++ translation units, their compile commands go to the database
+    static bool isSourceFile(const path &);
 };
 
 struct SwExecutionPlanGenerator : Generator
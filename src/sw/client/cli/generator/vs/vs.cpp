@@ -964,7 +964,7 @@ void Project::emitProject(const VSGenerator &g) const
 
             if (d.pre_link_command)
             {
-                auto cmd = d.pre_link_command->writeCommand(commands_dir / std::to_string(d.pre_link_command->getHash()));
+                auto cmd = d.pre_link_command->writeCommand(commands_dir / d.pre_link_command->getHash().toString());
 
                 ctx.beginBlock("PreLinkEvent");
                 ctx.beginBlock("Command");
@@ -1089,12 +1089,12 @@ void Project::emitProject(const VSGenerator &g) const
             path rule = rules_dir / c->outputs.begin()->filename();
             rules.insert(rule);
             if (rules.find(rule) != rules.end())
-                rule += "." + std::to_string(c->getHash());
+                rule += "." + c->getHash().toString();
             rule += ".rule";
             write_file(rule, "");
             ((Project&)*this).files.insert({rule, ". SW Rules"});
 
-            auto cmd = c->writeCommand(commands_dir / std::to_string(c->getHash()));
+            auto cmd = c->writeCommand(commands_dir / c->getHash().toString());
 
             ctx.beginFileBlock(rule);
 
@@ -1207,7 +1207,7 @@ void Project::emitFilters(const VSGenerator &g) const
         if (!f.filter.empty())
         {
             filters.insert(make_backslashes(f.filter.string()));
-            ctx.beginBlock(toString(get_vs_file_type_by_ext(f.p)), { {"Include", f.p.string()} });
+            ctx.beginBlock(toString(get_vs_file_type_by_ext(f.p)), { {"Include", normalize_path_windows(f.p)} });
             ctx.addBlock("Filter", make_backslashes(f.filter.string()));
             ctx.endBlock();
             continue;
@@ -1298,7 +1298,7 @@ void Project::emitFilters(const VSGenerator &g) const
             } while (!r.empty() && r != r.root_path());
         }
 
-        ctx.beginBlock(toString(get_vs_file_type_by_ext(f.p)), { {"Include", f.p.string()} });
+        ctx.beginBlock(toString(get_vs_file_type_by_ext(f.p)), { {"Include", normalize_path_windows(f.p)} });
         if (!filter.empty() && !filter.is_absolute())
             ctx.addBlock("Filter", make_backslashes(filter.string()));
         ctx.endBlock();
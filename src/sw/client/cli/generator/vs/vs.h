@@ -59,7 +59,8 @@ struct FileWithFilter
     // command
     // is generated
 
-    FileWithFilter(const path &p, const path &f = {}) : p(p), filter(f) {}
+    // same spelling as in command inputs and outputs, so files are not duplicated
+    FileWithFilter(const path &p, const path &f = {}) : p(fs::u8path(normalize_path(p))), filter(f) {}
 
     bool operator==(const FileWithFilter &rhs) const
     {
@@ -11,6 +11,8 @@
 #include "sw_context.h"
 
 #include <sw/builder/execution_plan.h>
+#include <sw/builder/output_cache.h>
+#include <sw/builder/remote_execution.h>
 
 #include <boost/current_function.hpp>
 #include <nlohmann/json.hpp>
@@ -89,6 +91,39 @@ static ExecutionPlan::Clock::duration parseTimeLimit(String tl)
     return d;
 }
 
+// 48G, 512M, 1024K or plain bytes
+static uint64_t parseMemoryLimit(const String &ml)
+{
+    size_t idx = 0;
+    uint64_t n = std::stoull(ml, &idx);
+    if (idx == ml.size())
+        return n;
+    if (idx + 1 != ml.size())
+        throw SW_RUNTIME_ERROR("Bad memory limit: " + ml);
+    switch (ml[idx])
+    {
+    case 'T':
+    case 't':
+        n *= 1024;
+        [[fallthrough]];
+    case 'G':
+    case 'g':
+        n *= 1024;
+        [[fallthrough]];
+    case 'M':
+    case 'm':
+        n *= 1024;
+        [[fallthrough]];
+    case 'K':
+    case 'k':
+        n *= 1024;
+        break;
+    default:
+        throw SW_RUNTIME_ERROR("Unknown memory size specifier: '"s + ml[idx] + "'");
+    }
+    return n;
+}
+
 SwBuild::SwBuild(SwContext &swctx, const path &build_dir)
     : swctx(swctx)
     , build_dir(build_dir)
@@ -412,10 +447,13 @@ void SwBuild::execute(ExecutionPlan &p) const
 
     p.build_always |= build_settings["build_always"] == "true";
     p.write_output_to_file |= build_settings["write_output_to_file"] == "true";
+    p.work_stealing |= build_settings["work_stealing"] == "true";
     if (build_settings["skip_errors"].isValue())
         p.skip_errors = std::stoll(build_settings["skip_errors"].getValue());
     if (build_settings["time_limit"].isValue())
         p.setTimeLimit(parseTimeLimit(build_settings["time_limit"].getValue()));
+    if (build_settings["memory_limit"].isValue())
+        p.memory_limit = parseMemoryLimit(build_settings["memory_limit"].getValue());
 
     //ScopedTime t;
     p.execute(getExecutor());
@@ -423,6 +461,11 @@ void SwBuild::execute(ExecutionPlan &p) const
     if (!silent && t2 > 0.15)
         LOG_INFO(logger, "Build time: " << t2 << " s.");*/
 
+    if (auto oc = getContext().getOutputCache())
+        LOG_INFO(logger, oc->printStats());
+    if (auto re = getContext().getRemoteExecutor())
+        LOG_INFO(logger, re->printStats());
+
     if (build_settings["time_trace"] == "true")
         p.saveChromeTrace(getBuildDirectory() / "misc" / "time_trace.json");
 
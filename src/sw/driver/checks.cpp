@@ -384,12 +384,15 @@ int main() { return IsBigEndian(); }
             fs::remove_all(checker.build.getChecksDir(), ec);
         };
 
-        //auto &e = getExecutor();
-        static Executor e(checks_single_thread ? 1 : getExecutor().numberOfThreads()); // separate executor!
-
         try
         {
-            ep.execute(e);
+            if (checks_single_thread)
+            {
+                static Executor e(1);
+                ep.execute(e);
+            }
+            else
+                ep.execute(getSecondaryExecutor());
         }
         catch (...)
         {
@@ -666,7 +669,7 @@ bool Check::lessDuringExecution(const CommandNode &in) const
 
     if (dependencies.size() != rhs.dependencies.size())
         return dependencies.size() < rhs.dependencies.size();
-    return dependent_commands.size() > dependent_commands.size();
+    return n_dependent_commands > rhs.n_dependent_commands;
 }
 
 path Check::getOutputFilename() const
@@ -9,6 +9,7 @@
 #include "build.h"
 #include "target/native.h"
 
+#include <sw/builder/depfile.h>
 #include <sw/builder/platform.h>
 #include <sw/core/sw_context.h>
 
@@ -147,11 +148,8 @@ std::shared_ptr<Command> VSCommand::clone() const
     return std::make_shared<VSCommand>(*this);
 }
 
-void VSCommand::postProcess1(bool)
+const String &VSCommand::getIncludePrefix() const
 {
-    // deps are placed into command output,
-    // so we can't skip this filtering
-
     // filter out includes and file name
     // but locales!
     // "Note: including file: filename\r" (english)
@@ -161,33 +159,54 @@ void VSCommand::postProcess1(bool)
     auto i = p.find(getProgram());
     if (i == p.end())
         throw SW_RUNTIME_ERROR("Cannot find msvc prefix");
-    auto &prefix = i->second;
+    return i->second;
+}
 
-    auto perform = [this, &prefix](auto &text)
-    {
-        std::deque<String> lines;
-        boost::split(lines, text, boost::is_any_of("\n"));
-        text.clear();
-        // remove filename
-        lines.pop_front();
+void VSCommand::setupFilters()
+{
+    // include lines are filtered while output comes from the pipe,
+    // so only diagnostics are accumulated
+    auto &prefix = getIncludePrefix();
+    out_filter = std::make_shared<ShowIncludesFilter>(prefix);
+    err_filter = std::make_shared<ShowIncludesFilter>(prefix);
+    out.action = [f = out_filter](const String &s, bool) { f->feed(s); };
+    err.action = [f = err_filter](const String &s, bool) { f->feed(s); };
+}
+
+void VSCommand::execute1(std::error_code *ec)
+{
+    setupFilters();
+    Command::execute1(ec);
+}
 
-        for (auto &line : lines)
+void VSCommand::postProcess1(bool)
+{
+    // deps are placed into command output,
+    // so we can't skip this filtering
+
+    auto perform = [this](auto &stream, auto &filter)
+    {
+        // output was not streamed (remote execution etc.)
+        if (!filter)
+            filter = std::make_shared<ShowIncludesFilter>(getIncludePrefix());
+        if (!filter->fed())
+            filter->feed(stream.text);
+        filter->finish();
+
+        stream.text = std::move(filter->text);
+        for (auto &i : filter->includes)
         {
-            if (line.find(prefix) != 0)
-            {
-                text += line + "\n";
-                continue;
-            }
-            auto include = line.substr(prefix.size());
-            boost::trim(include);
             //if (fs::exists(include)) // slow check? but correct?
-                addImplicitInput(include);
+                addImplicitInput(i);
         }
+        filter.reset();
     };
 
     // on errors msvc puts everything to stderr instead of stdout
-    perform(out.text);
-    perform(err.text);
+    perform(out, out_filter);
+    perform(err, err_filter);
+    out.action = {};
+    err.action = {};
 }
 
 std::shared_ptr<Command> GNUCommand::clone() const
@@ -209,70 +228,23 @@ void GNUCommand::postProcess1(bool ok)
         return;
     }
 
-    static const std::regex space_r("[^\\\\] ");
-
-    // deps file is a make in form
-    // target: dependencies
-    // deps are split by spaces on several lines with \ at the end of each line except the last one
-    //
-    // example:
-    //
-    // file.o: dep1.cpp dep2.cpp \
-    //  dep1.h dep2.h \
-    //  dep3.h \
-    //  dep4.h
-    //
-
+    // one read, paths are passed straight from the file contents
     auto f = read_file(deps_file);
-
-    // skip target
-    //  use exactly ': ' because on windows target is 'C:/path/to/file: '
-    //                                           skip up to this space ^
-    f = f.substr(f.find(": ") + 1);
-
-    boost::trim(f);
-    boost::replace_all(f, "\\\r", ""); // CR LF case or just CR
-    boost::replace_all(f, "\\\n", "");
-    boost::replace_all(f, "\r", "");
-    boost::replace_all(f, "\n", "");
-
-    FilesOrdered files;
-    size_t p = 0;
-    while (1)
+    parseDepfile(f, [this](std::string_view p)
     {
-        auto p2 = f.find(' ', p);
-        if (p2 == f.npos)
-        {
-            auto s = f.substr(p);
-            if (!s.empty())
-                files.push_back(s);
-            break;
-        }
-        // p2 may be 0
-        if (p2 && f[p2 - 1] != '\\')
-        {
-            auto s = f.substr(p, p2 - p);
-            if (!s.empty())
-                files.push_back(s);
-        }
-        p = p2;
-        p++;
-    }
-
-    for (auto &f2 : files)
-    {
-        auto f3 = normalize_path(f2);
 #ifdef CPPAN_OS_WINDOWS_NO_CYGWIN
-        static const String cyg = "/cygdrive/";
-        if (f3.find(cyg) == 0)
+        static const std::string_view cyg = "/cygdrive/";
+        if (p.find(cyg) == 0 && p.size() > cyg.size())
         {
-            f3 = f3.substr(cyg.size());
-            f3 = toupper(f3[0]) + ":" + f3.substr(1);
+            String f3(p.substr(cyg.size()));
+            f3 = String(1, (char)toupper(f3[0])) + ":" + f3.substr(1);
+            addImplicitInput(f3);
+            return;
         }
 #endif
-        //if (fs::exists(f3))
-            addImplicitInput(f3);
-    }
+        // interner normalizes the path once, on the first occurrence
+        addImplicitInput(path(p.begin(), p.end()));
+    });
 }
 
 ///
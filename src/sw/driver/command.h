@@ -11,6 +11,7 @@
 
 #include <sw/builder/command.h>
 #include <sw/builder/file.h>
+#include <sw/builder/show_includes.h>
 
 #include <boost/serialization/export.hpp>
 
@@ -357,6 +358,7 @@ struct SW_DRIVER_CPP_API Command : detail::Command
 
     virtual std::shared_ptr<Command> clone() const;
     void prepare() override;
+    bool isPreparedSerially() const override { return Base::isPreparedSerially() || !actions.empty(); }
 
     using Base::setProgram;
     void setProgram(const std::shared_ptr<Dependency> &);
@@ -364,6 +366,7 @@ struct SW_DRIVER_CPP_API Command : detail::Command
     // additional dependencies will be used to set up the command
     void addProgramDependency(const std::shared_ptr<Dependency> &);
 
+    /// Actions run in prepare(), commands with actions are prepared one by one.
     void addLazyAction(LazyAction f);
 
     using Base::operator|;
@@ -383,6 +386,13 @@ struct SW_DRIVER_CPP_API VSCommand : Command
     std::shared_ptr<Command> clone() const override;
 
 private:
+    // created when process starts, so copies do not share them
+    std::shared_ptr<ShowIncludesFilter> out_filter;
+    std::shared_ptr<ShowIncludesFilter> err_filter;
+
+    const String &getIncludePrefix() const;
+    void setupFilters();
+    void execute1(std::error_code *ec = nullptr) override;
     void postProcess1(bool ok) override;
 };
 
@@ -291,6 +291,8 @@ void ClangCompiler::prepareCommand1(const ::sw::Target &t)
         cmd->output_dirs.insert(cmd->deps_file.parent_path());
         cmd->working_directory = OutputFile().parent_path();
     }
+    // same toolchain is expected on remote workers
+    cmd->remote_prefix_map_option = "-ffile-prefix-map=";
 
     // not available for msvc triple
     // must be enabled on per target basis (when shared lib is built)?
@@ -450,6 +452,8 @@ void GNUCompiler::prepareCommand1(const Target &t)
         cmd->output_dirs.insert(cmd->deps_file.parent_path());
         cmd->working_directory = OutputFile().parent_path();
     }
+    // same toolchain is expected on remote workers
+    cmd->remote_prefix_map_option = "-ffile-prefix-map=";
 
     //if (cmd->file.empty())
         //return nullptr;
@@ -12,7 +12,9 @@
 #include "../functions.h"
 #include "../build.h"
 
+#include <sw/builder/execution_plan.h>
 #include <sw/builder/jumppad.h>
+#include <sw/builder/p1689.h>
 #include <sw/core/sw_context.h>
 #include <sw/manager/storage.h>
 #include <sw/manager/yaml.h>
@@ -1020,6 +1022,278 @@ void NativeCompiledTarget::resolvePostponedSourceFiles()
     }*/
 }
 
+void NativeCompiledTarget::setupUnityBuild()
+{
+    if (UnityBuildBatchSize <= 0)
+        throw SW_RUNTIME_ERROR("Bad unity build batch size: " + std::to_string(UnityBuildBatchSize));
+
+    const auto &cpp_exts = getCppSourceFileExtensions();
+
+    // per file compiler settings (definitions, flags, pch usage) are compared
+    // by command line of a copy of the compiler with placeholder source file
+    auto get_settings = [this](const NativeSourceFile &sf, const String &ext)
+    {
+        auto c = std::static_pointer_cast<NativeCompiler>(sf.compiler->clone());
+        path o = BinaryPrivateDir / "unity" / "settings";
+        c->setSourceFile(BinaryPrivateDir / "unity" / ("settings" + ext), o);
+        auto cmd = c->getCommand(*this);
+        String s = cmd->getProgram();
+        for (auto &a : cmd->arguments)
+            s += "\n" + a->toString();
+        return s;
+    };
+
+    // (unity file ext, compiler settings) -> sources
+    // only files with identical settings are batched,
+    // sorted by path, so batches are the same on every run
+    std::map<std::pair<String, String>, std::map<String, NativeSourceFile *>> sources;
+    for (auto &[p, f] : *this)
+    {
+        if (!f->isActive() || f->postponed)
+            continue;
+        auto sf = f->as<NativeSourceFile *>();
+        if (!sf)
+            continue;
+        // per file settings, pch sources etc.
+        if (sf->BuildAs != NativeSourceFile::BasedOnExtension ||
+            !sf->args.empty() ||
+            sf->skip_linking ||
+            !sf->fancy_name.empty() ||
+            !sf->dependencies.empty())
+            continue;
+        // unity file does not depend on generators of its sources
+        if (File(p, getFs()).isGeneratedAtAll())
+            continue;
+
+        auto ext = p.extension().string();
+        if (ext != ".c")
+        {
+            if (cpp_exts.find(ext) == cpp_exts.end() || ext == ".m" || ext == ".mm")
+                continue;
+            ext = ".cpp";
+        }
+        sources[{ ext, get_settings(*sf, ext) }][normalize_path(p)] = sf;
+    }
+
+    // unity files of all groups with the same extension are numbered together
+    std::map<String, int> n_unity_files;
+    for (auto &[key, files] : sources)
+    {
+        auto &ext = key.first;
+        // batches are cut by count, so editing of a file changes only its own batch
+        // (unless byte limit is set)
+        std::vector<std::vector<NativeSourceFile *>> batches(1);
+        uint64_t bytes = 0;
+        for (auto &[p, sf] : files)
+        {
+            uint64_t sz = 0;
+            if (UnityBuildMaxBytes)
+            {
+                error_code ec;
+                sz = fs::file_size(sf->file, ec);
+            }
+            auto &b = batches.back();
+            if (!b.empty() &&
+                (b.size() >= (size_t)UnityBuildBatchSize || (UnityBuildMaxBytes && bytes + sz > UnityBuildMaxBytes)))
+            {
+                batches.emplace_back();
+                bytes = 0;
+            }
+            batches.back().push_back(sf);
+            bytes += sz;
+        }
+
+        auto &i = n_unity_files[ext];
+        for (auto &b : batches)
+        {
+            // single file is compiled as is
+            if (b.size() < 2)
+                continue;
+
+            String s;
+            for (auto sf : b)
+            {
+                s += "#include \"" + normalize_path(sf->file) + "\"\n";
+                sf->skip = true;
+            }
+            path p = BinaryPrivateDir / "unity" / ("unity_" + std::to_string(i++) + ext);
+            write_file_if_different(p, s);
+
+            // more info for generators
+            File(p, getFs()).setGenerated(true);
+
+            operator+=(p);
+            auto u = ((*this)[p]).as<NativeSourceFile *>();
+            if (!u)
+                throw SW_RUNTIME_ERROR("Cannot create unity source file: " + normalize_path(p));
+            // take settings set before prepare (e.g. pch usage), they are the same for all batched files
+            u->compiler = std::static_pointer_cast<NativeCompiler>(b[0]->compiler->clone());
+            u->compiler->setSourceFile(p, u->output);
+        }
+    }
+}
+
+void NativeCompiledTarget::prepareModules(const std::unordered_set<NativeSourceFile*> &files)
+{
+    auto &ctx = getSolution().getContext();
+    const bool gcc = getCompilerType() == CompilerType::GNU;
+
+    auto cpp_exts = getCppSourceFileExtensions();
+    cpp_exts.erase(".m");
+    cpp_exts.erase(".mm");
+
+    // p1689 scanning of every c++ source, result is written to <object>.ddi
+    std::map<NativeSourceFile *, path> ddis;
+    Commands scans;
+    for (auto f : files)
+    {
+        if (f->skip || cpp_exts.find(f->file.extension().string()) == cpp_exts.end())
+            continue;
+
+        path ddi = f->output.u8string() + ".ddi";
+        if (auto c = f->compiler->as<GNUCompiler*>())
+        {
+            auto s = std::static_pointer_cast<GNUCompiler>(c->clone());
+            path o = f->output.u8string() + ".ii";
+            s->setSourceFile(f->file, o);
+            s->ModulesTS = true;
+            s->PreprocessOnly = true;
+            s->DependenciesFormat = "p1689r5";
+            s->DependenciesScanFile = ddi;
+            s->DependenciesTarget = f->output;
+            auto cmd = s->getCommand(*this);
+            // results are kept in command db, so scans are not repeated on every build
+            registerCommand(*cmd);
+            scans.insert(cmd);
+        }
+        else if (auto c = f->compiler->as<ClangCompiler*>())
+        {
+            // clang-scan-deps takes the whole compiler command line
+            auto s = std::static_pointer_cast<ClangCompiler>(c->clone());
+            path o = f->output.u8string() + ".scan.o";
+            s->setSourceFile(f->file, o);
+            auto c0 = s->getCommand(*this);
+
+            auto cmd = std::make_shared<driver::Command>(ctx);
+            cmd->setProgram(c->file.parent_path() / ("clang-scan-deps" + c->file.extension().u8string()));
+            cmd->working_directory = c0->working_directory;
+            cmd->arguments.push_back("-format=p1689");
+            cmd->arguments.push_back("--");
+            cmd->arguments.push_back(normalize_path(c->file));
+            for (auto &a : c0->arguments)
+                cmd->arguments.push_back(a->toString());
+            cmd->name = "[" + getPackage().toString() + "] scan " + normalize_path(f->file);
+            cmd->addInput(f->file);
+            cmd->redirectStdout(ddi);
+            registerCommand(*cmd);
+            scans.insert(cmd);
+        }
+        else
+            continue;
+        ddis[f] = ddi;
+    }
+    if (ddis.empty())
+        return;
+
+    // scans preprocess sources, so generated sources and headers must exist,
+    // they wait for the same generators as compile commands (see getCommands1())
+    // generated commands are not cached yet, target is in the middle of its prepare
+    auto generated = gatherGeneratedCommands();
+    for (auto &d : getAllDependencies())
+    {
+        if (d->IncludeDirectoriesOnly && !d->GenerateCommandsBefore)
+            continue;
+        auto nt = d->getTarget().as<NativeCompiledTarget *>();
+        if (!nt || nt == this)
+            continue;
+        auto cmds2 = nt->gatherGeneratedCommands();
+        for (auto &c : cmds2)
+        {
+            if (c->command_storage == builder::Command::CS_UNDEFINED)
+                c->command_storage = nt->getCommandStorageType();
+        }
+        generated.insert(cmds2.begin(), cmds2.end());
+    }
+    for (auto &c : generated)
+    {
+        if (c->command_storage == builder::Command::CS_UNDEFINED)
+            c->command_storage = getCommandStorageType();
+    }
+    for (auto &s : scans)
+        s->dependencies.insert(generated.begin(), generated.end());
+
+    // build plan is static, so module dependencies must be known before it is created
+    auto ep = ExecutionPlan::create(scans);
+    if (!ep)
+        throw SW_RUNTIME_ERROR(getPackage().toString() + ": cannot create module scanning plan");
+    ep.execute(getSecondaryExecutor());
+
+    std::vector<NativeSourceFile *> units;
+    std::vector<ModuleDeps> deps;
+    for (auto &[f, ddi] : ddis)
+    {
+        units.push_back(f);
+        deps.push_back(parseP1689(normalize_path(f->file), read_file(ddi)));
+    }
+    ModuleGraph g;
+    try
+    {
+        g = getModuleGraph(deps);
+    }
+    catch (std::exception &e)
+    {
+        throw SW_RUNTIME_ERROR(getPackage().toString() + ": " + e.what());
+    }
+
+    auto get_bmi = [this, gcc](const String &m)
+    {
+        return BinaryPrivateDir / "modules" / (boost::replace_all_copy(m, ":", "-") + (gcc ? ".gcm" : ".pcm"));
+    };
+
+    path mapper;
+    if (gcc)
+    {
+        String s;
+        for (auto &[m, _] : g.providers)
+            s += m + " " + normalize_path(get_bmi(m)) + "\n";
+        mapper = BinaryPrivateDir / "modules.map";
+        write_file_if_different(mapper, s);
+    }
+
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        auto f = units[i];
+        auto &d = deps[i];
+        auto cmd = f->compiler->createCommand(ctx);
+        if (auto c = f->compiler->as<GNUCompiler*>())
+        {
+            c->ModulesTS = true;
+            c->ModuleMapper = mapper;
+            for (auto &m : d.provides)
+                cmd->addOutput(get_bmi(m));
+        }
+        else if (auto c = f->compiler->as<ClangCompiler*>())
+        {
+            for (auto &m : d.provides)
+            {
+                c->ModuleOutput = get_bmi(m);
+                c->Language = "c++-module";
+            }
+            for (auto &[m, _] : g.providers)
+                c->ModuleFiles().push_back(m + "=" + normalize_path(get_bmi(m)));
+        }
+
+        for (auto p : g.imports[i])
+            f->dependencies.insert(units[p]);
+        for (auto &m : d.imports)
+        {
+            auto p = g.providers.find(m);
+            if (p != g.providers.end() && p->second != i)
+                cmd->addInput(get_bmi(m));
+        }
+    }
+}
+
 FilesOrdered NativeCompiledTarget::gatherLinkDirectories() const
 {
     FilesOrdered dirs;
@@ -1288,7 +1562,12 @@ Commands NativeCompiledTarget::getGeneratedCommands() const
     if (generated_commands)
         return generated_commands.value();
     generated_commands.emplace();
+    generated_commands = gatherGeneratedCommands();
+    return generated_commands.value();
+}
 
+Commands NativeCompiledTarget::gatherGeneratedCommands() const
+{
     Commands generated;
 
     const path def = NATIVE_TARGET_DEF_SYMBOLS_FILE;
@@ -1322,7 +1601,6 @@ Commands NativeCompiledTarget::getGeneratedCommands() const
         generated.insert(cmds.begin(), cmds.end());
     }
 
-    generated_commands = generated;
     return generated;
 }
 
@@ -1410,25 +1688,15 @@ Commands NativeCompiledTarget::getCommands1() const
 
         for (auto &[k, v] : break_gch_deps)
         {
-            auto input_pch = std::find_if(cmd->inputs.begin(), cmd->inputs.end(),
-                [k = std::ref(k)](const auto &p)
-            {
-                return p == k;
-            });
-            if (input_pch == cmd->inputs.end())
+            // lookup by interned path, iteration gives normalized spelling
+            // which is not equal to native one on windows
+            if (!cmd->inputs.count(k))
                 continue;
 
             for (auto &c : generated)
             {
-                auto output_gch = std::find_if(c->outputs.begin(), c->outputs.end(),
-                    [v = std::ref(v)](const auto &p)
-                {
-                    return p == v;
-                });
-                if (output_gch == c->outputs.end())
-                    continue;
-
-                cmd->dependencies.erase(c);
+                if (c->outputs.count(v))
+                    cmd->dependencies.erase(c);
             }
         }
     }
@@ -2057,8 +2325,15 @@ bool NativeCompiledTarget::prepare()
 
         if (UseModules)
         {
-            if (getCompilerType() != CompilerType::MSVC)
-                throw SW_RUNTIME_ERROR("Currently modules are implemented for MSVC only");
+            switch (getCompilerType())
+            {
+            case CompilerType::MSVC:
+            case CompilerType::GNU:
+            case CompilerType::Clang:
+                break;
+            default:
+                throw SW_RUNTIME_ERROR("Currently modules are implemented for MSVC, GCC and Clang only");
+            }
             CPPVersion = CPPLanguageStandard::CPP2a;
         }
 
@@ -2393,6 +2668,10 @@ bool NativeCompiledTarget::prepare()
                 c->VisibilityHidden = false;
         };
 
+        // replaces batched sources with unity files, before their compilers are set up
+        if (UnityBuild && !UseModules)
+            setupUnityBuild();
+
         auto files = gatherSourceFiles();
 
         // merge file compiler options with target compiler options
@@ -2446,6 +2725,10 @@ bool NativeCompiledTarget::prepare()
             }
         }
 
+        // gcc and clang modules are found by scanning, msvc ones are set up above
+        if (UseModules && getCompilerType() != CompilerType::MSVC)
+            prepareModules(files);
+
         // also merge rc files
         for (auto &f : ::sw::gatherSourceFiles<RcToolSourceFile>(*this))
         {
@@ -116,6 +116,15 @@ public:
 
     bool UseModules = false;
 
+    // unity (jumbo) build
+    // sources are compiled in batches, every batch is included into generated unity_N.cpp;
+    // sources with their own settings (args, BuildAs, pch) are compiled separately
+    bool UnityBuild = false;
+    // max number of sources in one batch
+    int UnityBuildBatchSize = 8;
+    // max total size of sources in one batch, 0 means no limit
+    uint64_t UnityBuildMaxBytes = 0;
+
     //
     virtual ~NativeCompiledTarget();
 
@@ -225,7 +234,10 @@ private:
     path getOutputFileName(const path &root) const;
     path getOutputFileName2(const path &subdir) const;
     Commands getGeneratedCommands() const;
+    Commands gatherGeneratedCommands() const;
     void resolvePostponedSourceFiles();
+    void setupUnityBuild();
+    void prepareModules(const std::unordered_set<NativeSourceFile*> &files);
     void gatherStaticLinkLibraries(LinkLibrariesType &ll, Files &added, std::unordered_set<const NativeCompiledTarget*> &targets, bool system) const;
     FilesOrdered gatherLinkDirectories() const;
     FilesOrdered gatherLinkLibraries() const;
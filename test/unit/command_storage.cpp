@@ -0,0 +1,239 @@
+#include <sw/builder/command_storage.h>
+
+#include <primitives/filesystem.h>
+
+#include <chrono>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+static CommandRecord make_record(uint64_t i)
+{
+    CommandRecord r;
+    r.hash = { i * 2654435761ULL + 1, i + 1 };
+    r.mtime = fs::file_time_type::clock::now();
+    r.duration = std::chrono::milliseconds(i);
+    r.peak_memory = i * 1024;
+    r.content_hash = i + 7;
+    return r;
+}
+
+static path log_name(const path &dir, int i)
+{
+    return dir / ("cmd_log_test_" + std::to_string(i) + ".bin");
+}
+
+static void write_log(const path &fn, uint64_t first, uint64_t n)
+{
+    std::vector<uint8_t> v;
+    for (auto i = first; i < first + n; i++)
+        FileDb::writeLogRecord(v, make_record(i));
+    detail::LogWriter w(fn);
+    w.write(v);
+}
+
+static size_t record_size()
+{
+    std::vector<uint8_t> v;
+    FileDb::writeLogRecord(v, make_record(0));
+    return v.size();
+}
+
+// which of records [0, n) are loaded from dir
+static std::vector<uint64_t> load(const path &dir, uint64_t n)
+{
+    detail::Storage s;
+    FileDb::load(s, dir);
+    std::vector<uint64_t> r;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (s.find(make_record(i).hash))
+            r.push_back(i);
+    }
+    return r;
+}
+
+static std::vector<uint64_t> range(uint64_t first, uint64_t last)
+{
+    std::vector<uint64_t> r;
+    for (auto i = first; i < last; i++)
+        r.push_back(i);
+    return r;
+}
+
+struct TempDir
+{
+    path dir;
+
+    TempDir()
+    {
+        dir = temp_directory_path() / "sw_test_command_storage" / unique_path();
+        fs::create_directories(dir);
+    }
+    ~TempDir()
+    {
+        error_code ec;
+        fs::remove_all(dir, ec);
+    }
+};
+
+TEST_CASE("Command log tail is checked", "[command_storage]")
+{
+    const auto rsz = record_size();
+
+    SECTION("torn tail")
+    {
+        TempDir d;
+        auto fn = log_name(d.dir, 0);
+        write_log(fn, 0, 10);
+        REQUIRE(load(d.dir, 10) == range(0, 10));
+
+        // half written record
+        fs::resize_file(fn, rsz * 10 - 5);
+        REQUIRE(load(d.dir, 10) == range(0, 9));
+        // half written header
+        fs::resize_file(fn, rsz * 9 + 3);
+        REQUIRE(load(d.dir, 10) == range(0, 9));
+        fs::resize_file(fn, 0);
+        REQUIRE(load(d.dir, 10).empty());
+    }
+
+    SECTION("checksum mismatch")
+    {
+        TempDir d;
+        auto fn = log_name(d.dir, 0);
+        write_log(fn, 0, 10);
+
+        // damage last byte of the 6th record, everything after it is not trusted
+        auto s = read_file(fn);
+        s[rsz * 6 - 1] ^= 0x55;
+        write_file(fn, s);
+        REQUIRE(load(d.dir, 10) == range(0, 5));
+    }
+}
+
+TEST_CASE("Command db compaction", "[command_storage]")
+{
+    TempDir d;
+    const uint64_t n = 3000;
+    for (int i = 0; i < 3; i++)
+        write_log(log_name(d.dir, i), i * 1000, 1000);
+
+    auto load_all = [&d]()
+    {
+        auto s = std::make_unique<detail::Storage>();
+        FileDb::load(*s, d.dir);
+        return s;
+    };
+    auto before = load_all();
+
+    std::atomic_bool stop = false;
+    REQUIRE(FileDb::compact(d.dir, stop));
+    REQUIRE(fs::exists(d.dir / "commands.bin"));
+    for (int i = 0; i < 3; i++)
+        REQUIRE_FALSE(fs::exists(log_name(d.dir, i)));
+    // nothing to do
+    REQUIRE_FALSE(FileDb::compact(d.dir, stop));
+
+    auto after = load_all();
+    for (uint64_t i = 0; i < n; i++)
+    {
+        auto h = make_record(i).hash;
+        auto r1 = before->find(h);
+        auto r2 = after->find(h);
+        REQUIRE(r1);
+        REQUIRE(r2);
+        REQUIRE(r1->hash == r2->hash);
+        REQUIRE(r1->mtime == r2->mtime);
+        REQUIRE(r1->duration == r2->duration);
+        REQUIRE(r1->peak_memory == r2->peak_memory);
+        REQUIRE(r1->content_hash == r2->content_hash);
+        REQUIRE(r1->implicit_inputs_set == r2->implicit_inputs_set);
+    }
+
+    // merge into existing segment
+    write_log(log_name(d.dir, 3), n, 500);
+    REQUIRE(FileDb::compact(d.dir, stop));
+    REQUIRE(load(d.dir, n + 500) == range(0, n + 500));
+
+    // stopped compaction leaves everything as is
+    write_log(log_name(d.dir, 4), n + 500, 500);
+    stop = true;
+    REQUIRE_FALSE(FileDb::compact(d.dir, stop));
+    REQUIRE(fs::exists(log_name(d.dir, 4)));
+    REQUIRE(load(d.dir, n + 1000) == range(0, n + 1000));
+}
+
+TEST_CASE("Command db set ids", "[command_storage]")
+{
+    detail::Storage s;
+    const std::vector<Hash128> a{ { 1, 2 }, { 3, 4 } }, b{ { 5, 6 } };
+
+    auto id = s.addSet(a);
+    REQUIRE(id);
+    // order and duplicates do not matter
+    REQUIRE(s.addSet({ { 3, 4 }, { 1, 2 }, { 3, 4 } }) == id);
+    REQUIRE(s.addSet({}) == 0);
+
+    // other set has the same id
+    s.sets[id] = b;
+    auto id2 = s.addSet(a);
+    REQUIRE(id2 != id);
+    REQUIRE(s.getSet(id) == b);
+    REQUIRE(s.getSet(id2) == a);
+    REQUIRE(s.addSet(a) == id2);
+}
+
+#ifndef _WIN32
+TEST_CASE("Command db compaction with concurrent writer", "[command_storage]")
+{
+    TempDir d;
+    const uint64_t n = 1000;
+    const int batches = 50;
+    write_log(log_name(d.dir, 0), 0, n);
+
+    // log locks are per process, so writer is a separate process
+    auto pid = fork();
+    REQUIRE(pid != -1);
+    if (pid == 0)
+    {
+        {
+            detail::LogWriter w(log_name(d.dir, 1));
+            for (int b = 0; b < batches; b++)
+            {
+                std::vector<uint8_t> v;
+                for (uint64_t i = 0; i < n / batches; i++)
+                    FileDb::writeLogRecord(v, make_record(n + b * (n / batches) + i));
+                w.write(v);
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+        _exit(0);
+    }
+
+    // live log must be skipped, merged logs must not lose records
+    std::atomic_bool stop = false;
+    while (waitpid(pid, nullptr, WNOHANG) == 0)
+    {
+        FileDb::compact(d.dir, stop);
+        write_log(log_name(d.dir, 2), 2 * n, n);
+    }
+    FileDb::compact(d.dir, stop);
+    REQUIRE(load(d.dir, 3 * n) == range(0, 3 * n));
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
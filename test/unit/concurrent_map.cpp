@@ -0,0 +1,137 @@
+#include <sw/builder/concurrent_map.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+struct Counted
+{
+    static inline std::atomic_int alive = 0;
+
+    size_t v = 0;
+
+    Counted() { alive++; }
+    Counted(const Counted &rhs) : v(rhs.v) { alive++; }
+    ~Counted() { alive--; }
+};
+
+template <class F>
+static void run_threads(size_t n, F &&f)
+{
+    std::vector<std::thread> t;
+    for (size_t i = 0; i < n; i++)
+        t.emplace_back(f, i);
+    for (auto &i : t)
+        i.join();
+}
+
+TEST_CASE("Checking concurrent map", "[concurrent_map]")
+{
+    {
+        ConcurrentMapSimple<Counted> m;
+        const size_t n = 100'000;
+
+        // every thread inserts the same keys, all of them must get the same values
+        std::vector<std::vector<Counted *>> ptrs(8, std::vector<Counted *>(n));
+        std::atomic_size_t inserted = 0;
+        run_threads(ptrs.size(), [&m, &ptrs, &inserted, n](size_t t)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                auto r = m.insert(i);
+                ptrs[t][i] = r.first;
+                inserted += r.second;
+            }
+        });
+        REQUIRE(inserted == n);
+        REQUIRE(m.size() == n);
+        for (auto &p : ptrs)
+            REQUIRE(p == ptrs[0]);
+        REQUIRE(m.find(0) == ptrs[0][0]);
+        REQUIRE(m.find(n) == nullptr);
+
+        // iteration during inserts
+        std::atomic_bool stop = false;
+        std::thread writer([&m, &stop, n]
+        {
+            for (size_t i = n; !stop; i++)
+                m[i].v = i;
+        });
+        size_t visited = 0;
+        for (const auto &[k, v] : m)
+        {
+            REQUIRE(m.find(k) == &v);
+            visited++;
+        }
+        stop = true;
+        writer.join();
+        REQUIRE(visited >= n);
+
+        REQUIRE((size_t)Counted::alive == m.size());
+    }
+    // values are owned by the map
+    REQUIRE(Counted::alive == 0);
+}
+
+template <class Insert, class Find>
+static auto bench(size_t threads, size_t n, Insert &&insert, Find &&find)
+{
+    std::vector<uint64_t> keys(n);
+    std::mt19937_64 g(n);
+    for (auto &k : keys)
+        k = g() | 1; // junction does not accept zero key
+
+    std::atomic_size_t inserted = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    run_threads(threads, [&keys, &insert, &find, &inserted, threads](size_t t)
+    {
+        // total amount of work does not depend on number of threads,
+        // there are more lookups than inserts, like in file storage
+        for (size_t i = t; i < keys.size(); i += threads)
+            insert(keys[i]);
+        inserted++;
+        while (inserted != threads)
+            std::this_thread::yield();
+        for (size_t i = t; i < keys.size() * 4; i += threads)
+            find(keys[i * 7919 % keys.size()]);
+    });
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+}
+
+TEST_CASE("Concurrent map benchmark", "[concurrent_map][.benchmark]")
+{
+    const size_t n = 1'000'000;
+    for (size_t threads : { 1, 2, 4, 8, 16, 32, 64 })
+    {
+        ConcurrentMap<uint64_t, Counted> m;
+        auto t = bench(threads, n,
+            [&m](auto k) { m.insert(k); },
+            [&m](auto k) { if (!m.find(k)) throw std::logic_error("missing key"); });
+        std::cout << threads << " threads: sharded map " << t << " ms\n";
+
+        // baseline: single lock over plain map, values are allocated the same way
+        std::mutex mb;
+        std::unordered_map<uint64_t, std::unique_ptr<Counted>> b;
+        t = bench(threads, n,
+            [&mb, &b](auto k) { std::unique_lock lk(mb); auto &v = b[k]; if (!v) v = std::make_unique<Counted>(); },
+            [&mb, &b](auto k) { std::unique_lock lk(mb); if (b.find(k) == b.end()) throw std::logic_error("missing key"); });
+        std::cout << threads << " threads: mutex + unordered_map " << t << " ms\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
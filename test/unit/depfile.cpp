@@ -0,0 +1,125 @@
+#include <sw/builder/depfile.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+static std::vector<std::string> parse(const std::string &s)
+{
+    std::vector<std::string> files;
+    parseDepfile(s, [&files](std::string_view p) { files.emplace_back(p); });
+    return files;
+}
+
+TEST_CASE("Checking depfile parser", "[depfile]")
+{
+    using V = std::vector<std::string>;
+
+    REQUIRE(parse("") == V{});
+    REQUIRE(parse("a.o:") == V{});
+    REQUIRE(parse("a.o: a.c") == V{ "a.c" });
+    REQUIRE(parse("a.o: a.c b.h\n") == V{ "a.c", "b.h" });
+    REQUIRE(parse("a.o : a.c") == V{ "a.c" });
+    REQUIRE(parse("a.o b.o: a.c") == V{ "a.c" });
+
+    // continuations
+    REQUIRE(parse("a.o: a.c \\\n b.h \\\n  c.h\n") == V{ "a.c", "b.h", "c.h" });
+    REQUIRE(parse("a.o: a.c \\\r\n b.h \\\r\n  c.h\r\n") == V{ "a.c", "b.h", "c.h" });
+    REQUIRE(parse("a.o: a.c\\\nb.h") == V{ "a.c", "b.h" });
+
+    // escapes
+    REQUIRE(parse("a.o: dir\\ with\\ spaces/a.c b.h") == V{ "dir with spaces/a.c", "b.h" });
+    REQUIRE(parse("a.o: \\#a.h $$b.h") == V{ "#a.h", "$b.h" });
+    REQUIRE(parse("a.o: c:\\dir\\a.h") == V{ "c:\\dir\\a.h" });
+
+    // windows drives
+    REQUIRE(parse("C:/dir/a.o: C:/dir/a.c D:/b.h") == V{ "C:/dir/a.c", "D:/b.h" });
+
+    // phony targets (-MP)
+    REQUIRE(parse("a.o: a.c b.h \\\n c.h\n\nb.h:\n\nc.h:\n") == V{ "a.c", "b.h", "c.h" });
+}
+
+// previous implementation, for comparison
+static std::vector<std::string> parse_old(std::string f)
+{
+    f = f.substr(f.find(": ") + 1);
+
+    boost::trim(f);
+    boost::replace_all(f, "\\\r", "");
+    boost::replace_all(f, "\\\n", "");
+    boost::replace_all(f, "\r", "");
+    boost::replace_all(f, "\n", "");
+
+    std::vector<std::string> files;
+    size_t p = 0;
+    while (1)
+    {
+        auto p2 = f.find(' ', p);
+        if (p2 == f.npos)
+        {
+            auto s = f.substr(p);
+            if (!s.empty())
+                files.push_back(s);
+            break;
+        }
+        if (p2 && f[p2 - 1] != '\\')
+        {
+            auto s = f.substr(p, p2 - p);
+            if (!s.empty())
+                files.push_back(s);
+        }
+        p = p2;
+        p++;
+    }
+    return files;
+}
+
+TEST_CASE("Depfile parser benchmark", "[depfile][.benchmark]")
+{
+    // looks like a depfile of a tu with heavy includes (boost, qt etc.)
+    const size_t n = 20'000;
+    std::string s = "/home/user/dev/project/.sw/out/12345678/obj/src/main.cpp.o: /home/user/dev/project/src/main.cpp";
+    for (size_t i = 0; i < n; i++)
+    {
+        s += " \\\n  /home/user/.sw/storage/pkg/aa/bb/cccccccc/src/include/boost/";
+        s += "module" + std::to_string(i % 100) + "/detail/header_" + std::to_string(i) + ".hpp";
+    }
+    s += "\n";
+
+    const int iterations = 20;
+    auto bench = [&s](auto &&f)
+    {
+        size_t total = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+            total += f(s);
+        auto t1 = std::chrono::steady_clock::now();
+        REQUIRE(total == (n + 1) * iterations);
+        return std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / iterations;
+    };
+
+    auto t_new = bench([](const auto &s)
+    {
+        size_t k = 0;
+        parseDepfile(s, [&k](std::string_view) { k++; });
+        return k;
+    });
+    auto t_old = bench([](const auto &s) { return parse_old(s).size(); });
+    std::cout << n << " entries (" << s.size() / 1024 << " KB): "
+        << "streaming parser " << t_new << " us, previous parser " << t_old << " us\n";
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <sw/builder/execution_plan.h>
+
+#include <primitives/executor.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+struct SyntheticCommand : CommandNode
+{
+    static inline std::atomic_size_t n_executed = 0;
+
+    size_t id;
+    size_t executed_as = 0;
+
+    SyntheticCommand(size_t id) : id(id) {}
+
+    String getName(bool) const override { return std::to_string(id); }
+    void execute() override { executed_as = ++n_executed; }
+    void prepare() override {}
+    bool lessDuringExecution(const CommandNode &rhs) const override
+    {
+        return dependencies.size() < rhs.dependencies.size();
+    }
+};
+
+using SyntheticCommands = std::unordered_set<std::shared_ptr<SyntheticCommand>>;
+
+// layered dag, every command depends on up to 'max_deps' commands from previous layers
+static SyntheticCommands make_commands(size_t n, size_t max_deps = 8)
+{
+    std::mt19937_64 g(n);
+    std::vector<std::shared_ptr<SyntheticCommand>> v;
+    v.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        auto c = std::make_shared<SyntheticCommand>(i);
+        if (i)
+        {
+            std::uniform_int_distribution<size_t> d(0, i - 1);
+            auto ndeps = g() % (max_deps + 1);
+            for (size_t j = 0; j < ndeps; j++)
+                c->dependencies.insert(v[d(g)]);
+        }
+        v.push_back(c);
+    }
+    return { v.begin(), v.end() };
+}
+
+TEST_CASE("Checking execution plan order", "[execution_plan]")
+{
+    auto cmds = make_commands(1000);
+    auto ep = ExecutionPlan::create(cmds);
+    REQUIRE(ep);
+    REQUIRE(ep.getCommands().size() == cmds.size());
+
+    // commands without deps go first
+    auto &v = ep.getCommands();
+    auto i = std::find_if(v.begin(), v.end(), [](auto c) { return !c->dependencies.empty(); });
+    REQUIRE(std::all_of(i, v.end(), [](auto c) { return !c->dependencies.empty(); }));
+
+    SECTION("cycle")
+    {
+        auto a = std::make_shared<SyntheticCommand>(cmds.size());
+        auto b = std::make_shared<SyntheticCommand>(cmds.size() + 1);
+        a->dependencies.insert(b);
+        b->dependencies.insert(a);
+        cmds.insert(a);
+        cmds.insert(b);
+        auto ep = ExecutionPlan::create(cmds);
+        REQUIRE_FALSE(ep);
+        REQUIRE(ep.getUnprocessedCommand().size() == 2);
+    }
+}
+
+TEST_CASE("Checking execution plan execution", "[execution_plan]")
+{
+    auto cmds = make_commands(1000);
+
+    // explicit reverse dependency
+    auto a = std::make_shared<SyntheticCommand>(cmds.size());
+    auto b = std::make_shared<SyntheticCommand>(cmds.size() + 1);
+    a->dependent_commands.insert(b);
+    cmds.insert(a);
+    cmds.insert(b);
+
+    auto ep = ExecutionPlan::create(cmds);
+    REQUIRE(ep);
+    REQUIRE(b->dependencies.count(a) == 1);
+    REQUIRE(a->n_dependent_commands == 1);
+
+    Executor e(4);
+    ep.execute(e);
+    for (auto &c : cmds)
+    {
+        REQUIRE(c->executed_as != 0);
+        for (auto &d : c->dependencies)
+            REQUIRE(std::static_pointer_cast<SyntheticCommand>(d)->executed_as < c->executed_as);
+    }
+}
+
+TEST_CASE("Execution plan creation benchmark", "[execution_plan][.benchmark]")
+{
+    for (size_t n : { 10'000, 100'000, 1'000'000 })
+    {
+        auto cmds = make_commands(n);
+        auto t0 = std::chrono::steady_clock::now();
+        auto ep = ExecutionPlan::create(cmds);
+        auto t1 = std::chrono::steady_clock::now();
+        REQUIRE(ep);
+        std::cout << n << " commands: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <sw/builder/p1689.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+// gcc -fdeps-format=p1689r5
+static const String gcc_ddi = R"({
+"rules": [
+{
+"primary-output": "a.o",
+"provides": [
+{
+"logical-name": "a:part",
+"is-interface": true
+},
+{
+"logical-name": "a",
+"is-interface": true
+}
+],
+"requires": [
+{
+"logical-name": "b"
+},
+{
+"logical-name": "<vector>",
+"lookup-method": "include-angle"
+},
+{
+"logical-name": "std"
+}
+]
+}
+],
+"version": 0,
+"revision": 0
+})";
+
+// clang-scan-deps -format=p1689
+static const String clang_ddi = R"({
+  "revision": 0,
+  "rules": [
+    {
+      "primary-output": "b.o",
+      "provides": [
+        {
+          "is-interface": true,
+          "logical-name": "b",
+          "source-path": "/src/b.cppm"
+        }
+      ]
+    }
+  ],
+  "version": 1
+})";
+
+TEST_CASE("Checking p1689 parser", "[p1689]")
+{
+    auto a = parseP1689("a.cpp", gcc_ddi);
+    REQUIRE(a.file == "a.cpp");
+    REQUIRE(a.provides == Strings{ "a:part", "a" });
+    // header units are skipped
+    REQUIRE(a.imports == Strings{ "b", "std" });
+
+    auto b = parseP1689("b.cppm", clang_ddi);
+    REQUIRE(b.provides == Strings{ "b" });
+    REQUIRE(b.imports.empty());
+
+    // plain tu
+    auto c = parseP1689("c.cpp", R"({"rules": [{"primary-output": "c.o"}], "version": 0, "revision": 0})");
+    REQUIRE(c.provides.empty());
+    REQUIRE(c.imports.empty());
+
+    REQUIRE_THROWS(parseP1689("d.cpp", "{\"rules\": ["));
+}
+
+TEST_CASE("Checking module graph", "[p1689]")
+{
+    ModuleDeps a{ "a.cpp", { "a:part", "a" }, { "b", "a:part", "std" } };
+    ModuleDeps b{ "b.cppm", { "b" }, {} };
+    ModuleDeps c{ "c.cpp", {}, { "a", "b" } };
+
+    auto g = getModuleGraph({ a, b, c });
+    REQUIRE(g.providers == std::map<String, size_t>{ { "a", 0 }, { "a:part", 0 }, { "b", 1 } });
+    REQUIRE(g.imports.size() == 3);
+    // own partition and std module are not edges
+    REQUIRE(g.imports[0] == std::vector<size_t>{ 1 });
+    REQUIRE(g.imports[1].empty());
+    REQUIRE(g.imports[2] == std::vector<size_t>{ 0, 1 });
+
+    ModuleDeps b2{ "b2.cppm", { "b" }, {} };
+    REQUIRE_THROWS_WITH(getModuleGraph({ b, b2 }), Catch::Contains("b.cppm") && Catch::Contains("b2.cppm"));
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
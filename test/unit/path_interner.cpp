@@ -0,0 +1,95 @@
+#include <sw/builder/path_interner.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+template <class F>
+static void run_threads(size_t n, F &&f)
+{
+    std::vector<std::thread> t;
+    for (size_t i = 0; i < n; i++)
+        t.emplace_back(f, i);
+    for (auto &i : t)
+        i.join();
+}
+
+static String spelling(size_t i, bool backslashes)
+{
+    auto s = "/sw_test_path_interner/dir" + std::to_string(i % 100) + "/file" + std::to_string(i) + ".cpp";
+    if (backslashes)
+        std::replace(s.begin(), s.end(), '/', '\\');
+    return s;
+}
+
+TEST_CASE("Checking path interner", "[path_interner]")
+{
+    auto &pi = getPathInterner();
+    const size_t n = 20'000;
+
+    // threads intern different spellings of the same paths at the same time,
+    // every spelling must get the same id
+    std::vector<std::vector<PathId>> ids(8, std::vector<PathId>(n));
+    std::vector<std::vector<const String *>> strings(ids.size(), std::vector<const String *>(n));
+    std::vector<std::vector<const Hash128 *>> hashes(ids.size(), std::vector<const Hash128 *>(n));
+    run_threads(ids.size(), [&pi, &ids, &strings, &hashes, n](size_t t)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            // lookup of not yet interned path or of other thread's result
+            auto f = pi.find(spelling(i, t % 2 == 0));
+            auto id = pi.intern(spelling(i, t % 2 != 0));
+            if (f && f != id)
+                throw std::logic_error("found id differs");
+            ids[t][i] = id;
+            strings[t][i] = &pi.getString(id);
+            hashes[t][i] = &pi.getHash(id);
+        }
+    });
+
+    for (auto &v : ids)
+        REQUIRE(v == ids[0]);
+    // stable references
+    for (auto &v : strings)
+        REQUIRE(v == strings[0]);
+    for (auto &v : hashes)
+        REQUIRE(v == hashes[0]);
+
+    std::unordered_set<PathId> unique(ids[0].begin(), ids[0].end());
+    REQUIRE(unique.size() == n);
+    REQUIRE(unique.count(0) == 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        auto id = ids[0][i];
+        REQUIRE(pi.getString(id) == spelling(i, false));
+        REQUIRE(pi.getHash(id) == Hasher128().update(spelling(i, false)).digest());
+        REQUIRE(pi.find(spelling(i, false)) == id);
+        REQUIRE(pi.find(spelling(i, true)) == id);
+    }
+    REQUIRE(pi.find(spelling(n, false)) == 0);
+}
+
+TEST_CASE("Checking path set", "[path_interner]")
+{
+    PathSet s;
+    REQUIRE(s.insert(spelling(0, false)).second);
+    REQUIRE_FALSE(s.insert(spelling(0, true)).second);
+    REQUIRE(s.size() == 1);
+    REQUIRE(s.count(spelling(0, true)) == 1);
+    // iteration gives normalized spelling
+    REQUIRE(normalize_path(*s.begin()) == spelling(0, false));
+    REQUIRE(s.erase(spelling(0, true)) == 1);
+    REQUIRE(s.empty());
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <sw/builder/show_includes.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+static const String prefix = "Note: including file:";
+
+static ShowIncludesFilter filter(const String &s, size_t chunk)
+{
+    ShowIncludesFilter f(prefix);
+    for (size_t i = 0; i < s.size(); i += chunk)
+        f.feed(std::string_view(s).substr(i, chunk));
+    f.feed({});
+    f.finish();
+    return f;
+}
+
+TEST_CASE("Checking /showIncludes filter", "[show_includes]")
+{
+    const String s =
+        "a.cpp\r\n"
+        "Note: including file: c:\\dir\\a.h\r\n"
+        "Note: including file:  c:\\dir with spaces\\b.h\r\n"
+        "a.cpp(3): error C2065: 'x': undeclared identifier\r\n"
+        "Note: including file:\tc:\\dir\\c.h \r\n"
+        "\r\n"
+        "Note: including file: c:\\dir\\d.h"; // no eol
+
+    const Strings includes{ "c:\\dir\\a.h", "c:\\dir with spaces\\b.h", "c:\\dir\\c.h", "c:\\dir\\d.h" };
+    const String text = "a.cpp(3): error C2065: 'x': undeclared identifier\r\n\r\n";
+
+    // lines are split by chunk boundaries at every position
+    for (size_t chunk : { 1, 2, 3, 7, 4096 })
+    {
+        auto f = filter(s, chunk);
+        INFO("chunk = " << chunk);
+        REQUIRE(f.fed());
+        REQUIRE(f.includes == includes);
+        REQUIRE(f.text == text);
+    }
+
+    // unix eols
+    {
+        auto f = filter("a.cpp\nNote: including file: /a.h\nwarning\n", 2);
+        REQUIRE(f.includes == Strings{ "/a.h" });
+        REQUIRE(f.text == "warning\n");
+    }
+
+    // nothing was fed
+    {
+        ShowIncludesFilter f(prefix);
+        f.finish();
+        REQUIRE_FALSE(f.fed());
+        REQUIRE(f.includes.empty());
+        REQUIRE(f.text.empty());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
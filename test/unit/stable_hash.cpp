@@ -0,0 +1,52 @@
+#include <sw/builder/stable_hash.h>
+
+#include <algorithm>
+#include <vector>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+TEST_CASE("Checking xxh64", "[stable_hash]")
+{
+    REQUIRE(xxh64("abc", 3) == 0x44bc2cf5ad770999ULL);
+
+    // values of reference implementation for bytes 0, 1, 2, ...
+    // every tail path and 32 byte stripes
+    std::vector<uint8_t> b(101);
+    for (size_t i = 0; i < b.size(); i++)
+        b[i] = (uint8_t)i;
+    struct
+    {
+        size_t sz;
+        uint64_t h0;
+        uint64_t h1;
+    } v[] =
+    {
+        { 0, 0xef46db3751d8e999ULL, 0xd5afba1336a3be4bULL },
+        { 3, 0xe5c7bb4533bc65ddULL, 0xa2168d89c582b451ULL },
+        { 7, 0x14cc643f630c72d2ULL, 0xaf4c5311c47c77b7ULL },
+        { 31, 0xc346d2b59b4d8ee1ULL, 0xf031031d65977dfcULL },
+        { 32, 0xcbf59c5116ff32b4ULL, 0xd74e6766ce9dba94ULL },
+        { 101, 0xe99038495f85381eULL, 0x436499928c06f890ULL },
+    };
+    for (auto &e : v)
+    {
+        INFO("size = " << e.sz);
+        REQUIRE(xxh64(b.data(), e.sz) == e.h0);
+        REQUIRE(xxh64(b.data(), e.sz, 1) == e.h1);
+    }
+
+    // unaligned input
+    std::vector<uint8_t> u(b.size() + 1);
+    std::copy(b.begin(), b.end(), u.begin() + 1);
+    REQUIRE(xxh64(u.data() + 1, b.size()) == xxh64(b.data(), b.size()));
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}